@@ -0,0 +1,110 @@
+#ifndef HACKCOMPUTER_H
+#define HACKCOMPUTER_H
+
+#include <string>
+#include <vector>
+#include <istream>
+#include <cstdint>
+#include <memory>
+#include <functional>
+
+class HackJit;
+
+class HackComputer {
+    /**
+     * The Hack computer of project 5 in software: 32K words of ROM, the CPU
+     * registers A, D and PC, and RAM with the memory mapped screen and keyboard.
+     * Every ROM word is decoded once when the program is loaded, so running an
+     * instruction is a single switch over a pre-decoded micro-op (run).
+     * runThreaded executes the same program with direct threaded dispatch over
+     * superinstructions, see threaded.cpp, and runJit compiles it to x86-64,
+     * see hackjit.cpp.
+     */
+    public:
+        static const int ROM_SIZE = 32768;
+        static const int RAM_SIZE = 24577; //16K data, 8K screen, keyboard
+        static const int SCREEN = 16384;
+        static const int KBD = 24576;
+
+        enum class Kind : uint8_t {
+            LOAD_A, //@value
+            HALT, //@pc followed by 0;JMP, a loop that never leaves
+            //computations, the first group only reads A and D
+            ZERO, ONE, NEG_ONE, D, A, NOT_D, NOT_A, NEG_D, NEG_A,
+            D_PLUS_1, A_PLUS_1, D_MINUS_1, A_MINUS_1, D_PLUS_A, D_MINUS_A, A_MINUS_D, D_AND_A, D_OR_A,
+            M, NOT_M, NEG_M, M_PLUS_1, M_MINUS_1, D_PLUS_M, D_MINUS_M, M_MINUS_D, D_AND_M, D_OR_M,
+            ALU //any other comp field, computed from its control bits
+        };
+
+        struct MicroOp {
+            Kind kind;
+            uint8_t dest; //bit 2 = A, bit 1 = D, bit 0 = M, as in the instruction
+            uint8_t jump; //bit 2 = out < 0, bit 1 = out == 0, bit 0 = out > 0
+            uint8_t alu; //a bit and zx nx zy ny f no, for Kind::ALU
+            uint16_t value; //for LOAD_A and HALT
+        };
+
+        enum class Fusion : uint8_t {
+            NONE, //a single instruction
+            LOAD, //@v, C              ex. @SP M=M+1
+            TOP, //@v, A=M-1, C        ex. @SP A=M-1 M=!M
+            POP //@v, AM=M-1, C        ex. @SP AM=M-1 D=M
+        };
+
+        struct ThreadedOp {
+            const void* handler; //label in runThreaded, resolved on its first run
+            MicroOp op; //the last instruction, value holds the @v of a fused one
+            Fusion fusion;
+            uint8_t length; //instructions it stands for
+        };
+
+    private:
+        std::vector<uint16_t> rom;
+        std::vector<MicroOp> code; //rom decoded, one micro-op per word
+        std::vector<ThreadedOp> threaded; //superinstruction starting at each address, one more to wrap around
+        bool threadedReady; //handlers of threaded resolved
+        int fusedCount;
+        std::vector<int16_t> ram; //32K, addresses above KBD are not installed but cannot crash the emulator
+        static const int SCRATCH = 32768; //one more word, written by instructions without an M destination
+        int16_t registerA;
+        int16_t registerD;
+        uint16_t pc;
+        bool isHalted;
+        bool hasHalt; //the program contains a halt loop
+        std::shared_ptr<HackJit> jit; //compiled blocks of the ROM, made by the first runJit
+        std::function<void(int)> ioHandler; //called before runJit executes an instruction with M in the screen or keyboard
+
+        static Kind decodeComp(int comp);
+        static int16_t alu(int control, int16_t x, int16_t y);
+        void decode();
+        void fuse();
+
+    public:
+        HackComputer();
+
+        void loadROM(const std::string& fileName); //"-" reads stdin
+        void loadROM(std::istream& input);
+        void setROM(const std::vector<uint16_t>& words);
+        const std::vector<uint16_t>& getROM() const { return rom; }
+        const std::vector<MicroOp>& getCode() const { return code; }
+        void reset();
+
+        long long run(long long maxCycles);
+        long long runThreaded(long long maxCycles);
+        long long runJit(long long maxCycles);
+        void setIOHandler(std::function<void(int)> handler); //address of the access
+        int jitBlocks() const; //blocks compiled by runJit so far
+        int superinstructions() const { return fusedCount; }
+        bool halted() const { return isHalted; }
+        bool hasHaltLoop() const { return hasHalt; }
+
+        int16_t peek(int address) const;
+        void poke(int address, int16_t value);
+        void setKey(int16_t key) { poke(KBD, key); }
+        int16_t getA() const { return registerA; }
+        int16_t getD() const { return registerD; }
+        uint16_t getPC() const { return pc; }
+        int16_t* memory() { return ram.data(); }
+};
+
+#endif // HACKCOMPUTER_H
@@ -0,0 +1,85 @@
+#ifndef HACKJIT_H
+#define HACKJIT_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <initializer_list>
+#include "hackcomputer.h"
+
+class HackJit {
+    /**
+     * Translates Hack basic blocks into x86-64 machine code, see hackjit.cpp.
+     * A block runs from a ROM address up to and including the first jump,
+     * each address it is entered at gets its own block. In the generated
+     * code A, D and the cycle budget live in host registers and Hack RAM is
+     * addressed through a base register.
+     * Only built for x86-64 Linux, HackComputer::runJit uses the threaded
+     * interpreter elsewhere.
+     */
+    public:
+        enum Exit {
+            EXIT_HALT, //pc is a halt loop
+            EXIT_BUDGET, //the block at pc needs more cycles than are left
+            EXIT_MISS, //computed jump to pc, which has no block yet
+            EXIT_CHAIN, //jump to pc, which has no block yet, site = the jump to patch
+            EXIT_IO //the instruction at pc reads or writes the screen or keyboard
+        };
+
+        struct State { //shared with the generated code, see the offsets in hackjit.cpp
+            int16_t* ram;
+            void* const* table;
+            int64_t budget; //cycles left
+            int32_t a;
+            int32_t d;
+            int32_t pc;
+            int32_t site;
+        };
+
+    private:
+        struct Site {
+            size_t offset; //of the rel32 of the jmp
+            int target;
+        };
+
+        std::vector<HackComputer::MicroOp> code;
+        bool ioExits;
+        uint8_t* buffer; //code, writable or executable, nullptr if the host allows no JIT
+        size_t capacity;
+        size_t used;
+        size_t epilogue; //offset of the code that returns to the host
+        std::vector<void*> table; //ROM address -> block, nullptr if not compiled
+        std::vector<Site> sites; //jumps to blocks not compiled yet
+        bool executable; //protection of buffer, see protect
+        int generation; //times the buffer was cleared
+        int blockCount;
+
+        void emit(std::initializer_list<uint8_t> bytes);
+        void emit32(int32_t value);
+        void emitJump(uint8_t opcode, size_t target); //jmp/call rel32
+        size_t emitJcc(uint8_t condition); //returns the offset of rel32 to patch
+        void patch(size_t offset, size_t target);
+        void emitExit(Exit reason, int pc);
+        void emitDynamicExit(); //pc in ecx
+        void emitSuccessor(int target);
+        void emitComputedJump();
+        void emitCompute(int control);
+        void writeTrampoline();
+        void clear();
+        void protect(bool execute);
+        void compile(int address);
+
+    public:
+        HackJit(const std::vector<HackComputer::MicroOp>& code, bool ioExits);
+        ~HackJit();
+        HackJit(const HackJit&) = delete;
+        HackJit& operator=(const HackJit&) = delete;
+
+        bool available() const { return buffer != nullptr; }
+        Exit enter(State& state);
+        void chain(int site, int target);
+        void* const* blocks() const { return table.data(); }
+        int compiledBlocks() const { return blockCount; }
+};
+
+#endif // HACKJIT_H
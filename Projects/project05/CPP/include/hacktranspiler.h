@@ -0,0 +1,40 @@
+#ifndef HACKTRANSPILER_H
+#define HACKTRANSPILER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ostream>
+#include "hackcomputer.h"
+
+class HackTranspiler {
+    /**
+     * Translates a Hack ROM ahead of time into a standalone C++ program that
+     * runs it like the emulator, with the same options and output, see
+     * hacktranspiler.cpp. Every basic block becomes a labeled region of one
+     * function, blocks jump to each other with goto and computed jumps go
+     * through a switch over the block addresses.
+     */
+    private:
+        std::vector<uint16_t> rom;
+        std::vector<HackComputer::MicroOp> code;
+        bool hasHalt;
+        std::vector<bool> leaders; //ROM address starts a block
+        std::map<int, std::string> markers; //ROM address -> source marker, from the assembler's .map
+
+        void findLeaders();
+        static std::string computation(const HackComputer::MicroOp& op, const std::string& memory);
+        void writeRuntime(std::ostream& output, const std::string& sourceName) const;
+        int writeBlock(std::ostream& output, int start) const; //returns the address after the block
+        void writeMain(std::ostream& output) const;
+
+    public:
+        explicit HackTranspiler(const HackComputer& computer);
+
+        void loadMap(const std::string& fileName);
+        void write(const std::string& fileName, const std::string& sourceName);
+        void write(std::ostream& output, const std::string& sourceName);
+        int blocks() const;
+};
+
+#endif // HACKTRANSPILER_H
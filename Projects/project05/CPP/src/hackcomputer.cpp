@@ -0,0 +1,249 @@
+#include "hackcomputer.h"
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <utility>
+
+HackComputer::HackComputer() : rom(), code(), threaded(), threadedReady(false), fusedCount(0), ram(SCRATCH + 1, 0), registerA(0), registerD(0), pc(0), isHalted(false), hasHalt(false), jit(), ioHandler() {
+    decode();
+    fuse();
+}
+
+void HackComputer::loadROM(const std::string& fileName) {
+    if (fileName == "-") {
+        loadROM(std::cin);
+        return;
+    }
+    std::ifstream file(fileName);
+    if (!file.is_open()) {
+        throw std::runtime_error("Could not open file: " + fileName);
+    }
+    loadROM(file);
+}
+
+void HackComputer::loadROM(std::istream& input) {
+    /**
+     * Reads a .hack file: one 16 character binary word per line, blank lines
+     * are skipped.
+     */
+    std::vector<uint16_t> words;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(input, line)) {
+        lineNumber++;
+        size_t first = line.find_first_not_of(" \t\r\n");
+        if (first == std::string::npos) continue;
+        size_t last = line.find_last_not_of(" \t\r\n");
+        std::string word = line.substr(first, last - first + 1);
+
+        if (word.size() != 16 || word.find_first_not_of("01") != std::string::npos) {
+            throw std::runtime_error("Invalid instruction at line " + std::to_string(lineNumber) + ": " + word);
+        }
+        uint16_t value = 0;
+        for (char bit : word) {
+            value = static_cast<uint16_t>((value << 1) | (bit - '0'));
+        }
+        words.push_back(value);
+    }
+    setROM(words);
+}
+
+void HackComputer::setROM(const std::vector<uint16_t>& words) {
+    if (words.size() > ROM_SIZE) {
+        throw std::runtime_error("Program does not fit in ROM: " + std::to_string(words.size()) + " words");
+    }
+    rom = words;
+    decode();
+    fuse();
+    jit.reset();
+    reset();
+}
+
+void HackComputer::setIOHandler(std::function<void(int)> handler) {
+    /**
+     * Has runJit leave the compiled code before every screen or keyboard
+     * access, to call handler with the address, ex. to redraw or poll keys.
+     */
+    ioHandler = std::move(handler);
+    jit.reset(); //the blocks are compiled with or without the exits
+}
+
+void HackComputer::reset() {
+    /**
+     * The reset button: PC = 0. RAM and the registers keep their values,
+     * like the hardware.
+     */
+    pc = 0;
+    isHalted = false;
+}
+
+HackComputer::Kind HackComputer::decodeComp(int comp) {
+    /**
+     * Maps the a bit and c1..c6 of a C-instruction to the computation.
+     * The 28 comp fields of the Hack language get their own kind, the rest
+     * go through the general ALU.
+     */
+    switch (comp) {
+        case 0b0101010: return Kind::ZERO;
+        case 0b0111111: return Kind::ONE;
+        case 0b0111010: return Kind::NEG_ONE;
+        case 0b0001100: return Kind::D;
+        case 0b0110000: return Kind::A;
+        case 0b0001101: return Kind::NOT_D;
+        case 0b0110001: return Kind::NOT_A;
+        case 0b0001111: return Kind::NEG_D;
+        case 0b0110011: return Kind::NEG_A;
+        case 0b0011111: return Kind::D_PLUS_1;
+        case 0b0110111: return Kind::A_PLUS_1;
+        case 0b0001110: return Kind::D_MINUS_1;
+        case 0b0110010: return Kind::A_MINUS_1;
+        case 0b0000010: return Kind::D_PLUS_A;
+        case 0b0010011: return Kind::D_MINUS_A;
+        case 0b0000111: return Kind::A_MINUS_D;
+        case 0b0000000: return Kind::D_AND_A;
+        case 0b0010101: return Kind::D_OR_A;
+        case 0b1110000: return Kind::M;
+        case 0b1110001: return Kind::NOT_M;
+        case 0b1110011: return Kind::NEG_M;
+        case 0b1110111: return Kind::M_PLUS_1;
+        case 0b1110010: return Kind::M_MINUS_1;
+        case 0b1000010: return Kind::D_PLUS_M;
+        case 0b1010011: return Kind::D_MINUS_M;
+        case 0b1000111: return Kind::M_MINUS_D;
+        case 0b1000000: return Kind::D_AND_M;
+        case 0b1010101: return Kind::D_OR_M;
+        default: return Kind::ALU;
+    }
+}
+
+int16_t HackComputer::alu(int control, int16_t x, int16_t y) {
+    /**
+     * The ALU of project 2, control = zx nx zy ny f no (the a bit is ignored).
+     */
+    if (control & 0b100000) x = 0;
+    if (control & 0b010000) x = ~x;
+    if (control & 0b001000) y = 0;
+    if (control & 0b000100) y = ~y;
+    int16_t out = (control & 0b000010) ? static_cast<int16_t>(x + y) : static_cast<int16_t>(x & y);
+    if (control & 0b000001) out = ~out;
+    return out;
+}
+
+void HackComputer::decode() {
+    /**
+     * Decodes every ROM word into code. Words past the program are 0, @0 like
+     * in the empty ROM of the hardware simulator.
+     * A halt loop is @k at address k followed by 0;JMP with no destination.
+     */
+    code.assign(ROM_SIZE, MicroOp{Kind::LOAD_A, 0, 0, 0, 0});
+    hasHalt = false;
+    for (size_t address = 0; address < rom.size(); address++) {
+        uint16_t word = rom[address];
+        MicroOp& op = code[address];
+        if (!(word & 0x8000)) {
+            op.value = word;
+            bool loop = word == address && address + 1 < rom.size() &&
+                        (rom[address + 1] & 0xE03F) == 0xE007; //C-instruction, no dest, JMP
+            if (loop) {
+                op.kind = Kind::HALT;
+                hasHalt = true;
+            }
+            continue;
+        }
+        int comp = (word >> 6) & 0x7F;
+        op.kind = decodeComp(comp);
+        op.alu = static_cast<uint8_t>(comp);
+        op.dest = static_cast<uint8_t>((word >> 3) & 7);
+        op.jump = static_cast<uint8_t>(word & 7);
+    }
+}
+
+long long HackComputer::run(long long maxCycles) {
+    /**
+     * Executes up to maxCycles instructions, one per cycle, stopping early
+     * when the program reaches a halt loop.
+     * @return the number of instructions executed
+     */
+    int16_t a = registerA;
+    int16_t d = registerD;
+    uint16_t next = pc;
+    int16_t* memory = ram.data();
+    const MicroOp* program = code.data();
+    long long cycles = 0;
+    bool halt = false;
+
+    for (; cycles < maxCycles; cycles++) {
+        const MicroOp& op = program[next];
+        int16_t out;
+        switch (op.kind) {
+            case Kind::LOAD_A:
+                a = static_cast<int16_t>(op.value);
+                next = (next + 1) & 0x7FFF;
+                continue;
+            case Kind::HALT:
+                halt = true;
+                out = 0;
+                break;
+            case Kind::ZERO: out = 0; break;
+            case Kind::ONE: out = 1; break;
+            case Kind::NEG_ONE: out = -1; break;
+            case Kind::D: out = d; break;
+            case Kind::A: out = a; break;
+            case Kind::NOT_D: out = ~d; break;
+            case Kind::NOT_A: out = ~a; break;
+            case Kind::NEG_D: out = static_cast<int16_t>(-d); break;
+            case Kind::NEG_A: out = static_cast<int16_t>(-a); break;
+            case Kind::D_PLUS_1: out = static_cast<int16_t>(d + 1); break;
+            case Kind::A_PLUS_1: out = static_cast<int16_t>(a + 1); break;
+            case Kind::D_MINUS_1: out = static_cast<int16_t>(d - 1); break;
+            case Kind::A_MINUS_1: out = static_cast<int16_t>(a - 1); break;
+            case Kind::D_PLUS_A: out = static_cast<int16_t>(d + a); break;
+            case Kind::D_MINUS_A: out = static_cast<int16_t>(d - a); break;
+            case Kind::A_MINUS_D: out = static_cast<int16_t>(a - d); break;
+            case Kind::D_AND_A: out = d & a; break;
+            case Kind::D_OR_A: out = d | a; break;
+            case Kind::M: out = memory[a & 0x7FFF]; break;
+            case Kind::NOT_M: out = ~memory[a & 0x7FFF]; break;
+            case Kind::NEG_M: out = static_cast<int16_t>(-memory[a & 0x7FFF]); break;
+            case Kind::M_PLUS_1: out = static_cast<int16_t>(memory[a & 0x7FFF] + 1); break;
+            case Kind::M_MINUS_1: out = static_cast<int16_t>(memory[a & 0x7FFF] - 1); break;
+            case Kind::D_PLUS_M: out = static_cast<int16_t>(d + memory[a & 0x7FFF]); break;
+            case Kind::D_MINUS_M: out = static_cast<int16_t>(d - memory[a & 0x7FFF]); break;
+            case Kind::M_MINUS_D: out = static_cast<int16_t>(memory[a & 0x7FFF] - d); break;
+            case Kind::D_AND_M: out = d & memory[a & 0x7FFF]; break;
+            case Kind::D_OR_M: out = d | memory[a & 0x7FFF]; break;
+            default: out = alu(op.alu, d, (op.alu & 0x40) ? memory[a & 0x7FFF] : a); break;
+        }
+        if (halt) break;
+
+        uint16_t target = a & 0x7FFF; //jumps go to A before this instruction writes it
+        memory[(op.dest & 1) ? target : SCRATCH] = out; //selects instead of branching, the destinations are hard to predict
+        d = (op.dest & 2) ? out : d;
+        a = (op.dest & 4) ? out : a;
+        next = (next + 1) & 0x7FFF;
+        if (op.jump != 0) { //a branch, not a select: the next fetch need not wait for out
+            int condition = out < 0 ? 4 : (out == 0 ? 2 : 1);
+            if (op.jump & condition) next = target;
+        }
+    }
+
+    registerA = a;
+    registerD = d;
+    pc = next;
+    isHalted = halt;
+    return cycles;
+}
+
+int16_t HackComputer::peek(int address) const {
+    if (address < 0 || address >= RAM_SIZE) {
+        throw std::runtime_error("RAM address out of range: " + std::to_string(address));
+    }
+    return ram[address];
+}
+
+void HackComputer::poke(int address, int16_t value) {
+    if (address < 0 || address >= RAM_SIZE) {
+        throw std::runtime_error("RAM address out of range: " + std::to_string(address));
+    }
+    ram[address] = value;
+}
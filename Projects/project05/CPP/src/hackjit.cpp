@@ -0,0 +1,394 @@
+#include "hackjit.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <sys/mman.h>
+#include <stdexcept>
+#include <cstring>
+
+//register use in the generated code:
+//rbx = Hack RAM, rbp = State, r12d = A, r13d = D, r14 = cycles left, r15 = block table
+//eax = ALU x and result, edx = ALU y, ecx = A & 0x7FFF for M and jumps
+//only the low 16 bits of A, D and eax are meaningful
+
+static const size_t CODE_SIZE = 16 << 20;
+static const size_t BLOCK_SPACE = 64 << 10; //more than the largest block
+static const int MAX_BLOCK = 256; //instructions
+
+static_assert(offsetof(HackJit::State, ram) == 0x00, "State layout is used by the generated code");
+static_assert(offsetof(HackJit::State, table) == 0x08, "State layout is used by the generated code");
+static_assert(offsetof(HackJit::State, budget) == 0x10, "State layout is used by the generated code");
+static_assert(offsetof(HackJit::State, a) == 0x18, "State layout is used by the generated code");
+static_assert(offsetof(HackJit::State, d) == 0x1C, "State layout is used by the generated code");
+static_assert(offsetof(HackJit::State, pc) == 0x20, "State layout is used by the generated code");
+static_assert(offsetof(HackJit::State, site) == 0x24, "State layout is used by the generated code");
+
+HackJit::HackJit(const std::vector<HackComputer::MicroOp>& code, bool ioExits)
+    : code(code), ioExits(ioExits), buffer(nullptr), capacity(CODE_SIZE), used(0), epilogue(0),
+      table(HackComputer::ROM_SIZE, nullptr), executable(false), generation(0), blockCount(0) {
+    /**
+     * The buffer is never writable and executable at once: it is written
+     * while blocks are compiled and chained, and executed in enter. Where the
+     * host does not allow that either (ex. SELinux without execmem),
+     * available() is false and runJit uses the threaded interpreter.
+     */
+    void* memory = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return;
+    buffer = static_cast<uint8_t*>(memory);
+    writeTrampoline();
+    if (mprotect(buffer, capacity, PROT_READ | PROT_EXEC) != 0) {
+        munmap(buffer, capacity);
+        buffer = nullptr;
+        return;
+    }
+    executable = true;
+}
+
+HackJit::~HackJit() {
+    if (buffer != nullptr) munmap(buffer, capacity);
+}
+
+void HackJit::protect(bool execute) {
+    /**
+     * Switches the buffer between writable (compiling) and executable.
+     */
+    if (execute == executable) return;
+    if (mprotect(buffer, capacity, execute ? PROT_READ | PROT_EXEC : PROT_READ | PROT_WRITE) != 0) {
+        throw std::runtime_error("Could not change the protection of the JIT code buffer");
+    }
+    executable = execute;
+}
+
+void HackJit::emit(std::initializer_list<uint8_t> bytes) {
+    for (uint8_t byte : bytes) buffer[used++] = byte;
+}
+
+void HackJit::emit32(int32_t value) {
+    std::memcpy(buffer + used, &value, 4);
+    used += 4;
+}
+
+void HackJit::emitJump(uint8_t opcode, size_t target) {
+    emit({opcode});
+    emit32(static_cast<int32_t>(target - (used + 4)));
+}
+
+size_t HackJit::emitJcc(uint8_t condition) {
+    /**
+     * Conditional jump with a rel32 that patch fills in later.
+     * @param condition second opcode byte, ex. 0x84 for je
+     */
+    emit({0x0F, condition});
+    size_t offset = used;
+    emit32(0);
+    return offset;
+}
+
+void HackJit::patch(size_t offset, size_t target) {
+    int32_t relative = static_cast<int32_t>(target - (offset + 4));
+    std::memcpy(buffer + offset, &relative, 4);
+}
+
+void HackJit::writeTrampoline() {
+    /**
+     * At the start of the buffer: Exit entry(State* rdi, void* block rsi)
+     * loads the registers from State and jumps to the block. The epilogue
+     * after it stores them back and returns eax, every exit jumps there.
+     */
+    emit({0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57}); //push rbx rbp r12 r13 r14 r15
+    emit({0x48, 0x89, 0xFD}); //mov rbp, rdi
+    emit({0x48, 0x8B, 0x5D, 0x00}); //mov rbx, [rbp + ram]
+    emit({0x44, 0x8B, 0x65, 0x18}); //mov r12d, [rbp + a]
+    emit({0x44, 0x8B, 0x6D, 0x1C}); //mov r13d, [rbp + d]
+    emit({0x4C, 0x8B, 0x75, 0x10}); //mov r14, [rbp + budget]
+    emit({0x4C, 0x8B, 0x7D, 0x08}); //mov r15, [rbp + table]
+    emit({0xFF, 0xE6}); //jmp rsi
+
+    epilogue = used;
+    emit({0x44, 0x89, 0x65, 0x18}); //mov [rbp + a], r12d
+    emit({0x44, 0x89, 0x6D, 0x1C}); //mov [rbp + d], r13d
+    emit({0x4C, 0x89, 0x75, 0x10}); //mov [rbp + budget], r14
+    emit({0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B}); //pop r15 r14 r13 r12 rbp rbx
+    emit({0xC3}); //ret
+}
+
+void HackJit::clear() {
+    /**
+     * Drops every block when the buffer is full, they are compiled again as
+     * they are reached.
+     */
+    used = epilogue;
+    emit({0x44, 0x89, 0x65, 0x18, 0x44, 0x89, 0x6D, 0x1C, 0x4C, 0x89, 0x75, 0x10,
+          0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B, 0xC3}); //the epilogue again
+    std::fill(table.begin(), table.end(), nullptr);
+    sites.clear();
+    generation++;
+}
+
+void HackJit::emitExit(Exit reason, int pc) {
+    emit({0xC7, 0x45, 0x20}); //mov dword [rbp + pc], pc
+    emit32(pc);
+    emit({0xB8}); //mov eax, reason
+    emit32(reason);
+    emitJump(0xE9, epilogue);
+}
+
+void HackJit::emitDynamicExit() {
+    emit({0x89, 0x4D, 0x20}); //mov [rbp + pc], ecx
+    emit({0xB8}); //mov eax, EXIT_MISS
+    emit32(EXIT_MISS);
+    emitJump(0xE9, epilogue);
+}
+
+void HackJit::emitSuccessor(int target) {
+    /**
+     * Jump to the block at a constant ROM address. A block compiled already
+     * is jumped to directly, otherwise the jump goes to an exit that has the
+     * host compile the target and chain the two by patching the jump.
+     */
+    if (table[target] != nullptr) {
+        emitJump(0xE9, static_cast<uint8_t*>(table[target]) - buffer);
+        return;
+    }
+    emit({0xE9});
+    sites.push_back({used, target});
+    emit32(0); //on to the exit below until chained
+    emit({0xC7, 0x45, 0x24}); //mov dword [rbp + site], index
+    emit32(static_cast<int32_t>(sites.size() - 1));
+    emitExit(EXIT_CHAIN, target);
+}
+
+void HackJit::emitComputedJump() {
+    /**
+     * Jump to the ROM address in ecx through the block table, leaving to the
+     * host if the target has no block yet.
+     */
+    emit({0x49, 0x8B, 0x04, 0xCF}); //mov rax, [r15 + rcx * 8]
+    emit({0x48, 0x85, 0xC0}); //test rax, rax
+    size_t miss = emitJcc(0x84); //jz
+    emit({0xFF, 0xE0}); //jmp rax
+    patch(miss, used);
+    emitDynamicExit();
+}
+
+void HackJit::emitCompute(int control) {
+    /**
+     * eax = ALU(x = D, y = A or M), straight from the control bits of the
+     * instruction: a zx nx zy ny f no. M is read through ecx.
+     */
+    if (control & 0b0100000) {
+        emit({0x31, 0xC0}); //xor eax, eax
+    } else {
+        emit({0x44, 0x89, 0xE8}); //mov eax, r13d
+    }
+    if (control & 0b0010000) emit({0xF7, 0xD0}); //not eax
+
+    if (control & 0b0001000) {
+        emit({0x31, 0xD2}); //xor edx, edx
+    } else if (control & 0b1000000) {
+        emit({0x0F, 0xB7, 0x14, 0x4B}); //movzx edx, word [rbx + rcx * 2]
+    } else {
+        emit({0x44, 0x89, 0xE2}); //mov edx, r12d
+    }
+    if (control & 0b0000100) emit({0xF7, 0xD2}); //not edx
+
+    if (control & 0b0000010) {
+        emit({0x01, 0xD0}); //add eax, edx
+    } else {
+        emit({0x21, 0xD0}); //and eax, edx
+    }
+    if (control & 0b0000001) emit({0xF7, 0xD0}); //not eax
+}
+
+void HackJit::compile(int address) {
+    /**
+     * Compiles the block entered at address and enters it in the table.
+     * The block checks the cycle budget once for all its instructions.
+     * A is tracked while it holds a constant, so @label before a jump gives
+     * a direct jump and @R13 before M needs no masking. With ioExits, any
+     * instruction that may touch M at SCREEN or above leaves to the host
+     * before it runs.
+     */
+    protect(false);
+    if (capacity - used < BLOCK_SPACE) clear();
+    table[address] = buffer + used;
+    blockCount++;
+
+    using Kind = HackComputer::Kind;
+    if (code[address].kind == Kind::HALT) { //halted only with a cycle left, as in run
+        emit({0x4D, 0x85, 0xF6}); //test r14, r14
+        size_t left = emitJcc(0x8F); //jg
+        emitExit(EXIT_BUDGET, address);
+        patch(left, used);
+        emitExit(EXIT_HALT, address);
+        return;
+    }
+
+    int length = 0;
+    for (int at = address; at < HackComputer::ROM_SIZE && length < MAX_BLOCK; at++) {
+        if (code[at].kind == Kind::HALT && length > 0) break; //the halt loop is a block of its own
+        length++;
+        if (code[at].kind != Kind::LOAD_A && code[at].jump != 0) break;
+    }
+
+    emit({0x49, 0x81, 0xFE}); //cmp r14, length
+    emit32(length);
+    size_t enough = emitJcc(0x8D); //jge
+    emitExit(EXIT_BUDGET, address);
+    patch(enough, used);
+    emit({0x49, 0x81, 0xEE}); //sub r14, length
+    emit32(length);
+
+    int knownA = -1; //value of A while it is a constant of the block
+    for (int i = 0; i < length; i++) {
+        int at = address + i;
+        const HackComputer::MicroOp& op = code[at];
+        if (op.kind == Kind::LOAD_A) {
+            emit({0x41, 0xBC}); //mov r12d, value
+            emit32(op.value);
+            knownA = op.value;
+            continue;
+        }
+
+        bool readsM = (op.alu & 0x40) != 0;
+        bool writesM = (op.dest & 1) != 0;
+        if (readsM || writesM || op.jump != 0) {
+            if (knownA >= 0) {
+                emit({0xB9}); //mov ecx, A
+                emit32(knownA & 0x7FFF);
+            } else {
+                emit({0x41, 0x0F, 0xB7, 0xCC}); //movzx ecx, r12w
+                emit({0x81, 0xE1, 0xFF, 0x7F, 0x00, 0x00}); //and ecx, 0x7FFF
+            }
+        }
+        if (ioExits && (readsM || writesM)) {
+            if (knownA >= 0 && (knownA & 0x7FFF) >= HackComputer::SCREEN) {
+                emit({0x49, 0x81, 0xC6}); //add r14, instructions not run
+                emit32(length - i);
+                emitExit(EXIT_IO, at);
+                return;
+            }
+            if (knownA < 0) {
+                emit({0x81, 0xF9}); //cmp ecx, SCREEN
+                emit32(HackComputer::SCREEN);
+                size_t memory = emitJcc(0x82); //jb
+                emit({0x49, 0x81, 0xC6}); //add r14, instructions not run
+                emit32(length - i);
+                emitExit(EXIT_IO, at);
+                patch(memory, used);
+            }
+        }
+
+        emitCompute(op.alu);
+        int target = knownA; //jumps go to A before this instruction writes it
+        if (writesM) emit({0x66, 0x89, 0x04, 0x4B}); //mov [rbx + rcx * 2], ax
+        if (op.dest & 2) emit({0x41, 0x89, 0xC5}); //mov r13d, eax
+        if (op.dest & 4) {
+            emit({0x41, 0x89, 0xC4}); //mov r12d, eax
+            knownA = -1;
+        }
+
+        if (op.jump == 0) continue;
+        static const uint8_t conditions[8] = {0, 0x8F, 0x84, 0x8D, 0x8C, 0x85, 0x8E, 0}; //jg je jge jl jne jle
+        size_t taken = 0;
+        if (op.jump != 7) {
+            emit({0x66, 0x85, 0xC0}); //test ax, ax
+            taken = emitJcc(conditions[op.jump]);
+            emitSuccessor((at + 1) & 0x7FFF);
+            patch(taken, used);
+        }
+        if (target >= 0) {
+            emitSuccessor(target & 0x7FFF);
+        } else {
+            emitComputedJump();
+        }
+        return;
+    }
+    emitSuccessor((address + length) & 0x7FFF);
+}
+
+HackJit::Exit HackJit::enter(State& state) {
+    /**
+     * Runs compiled code from state.pc, compiling its block first if needed,
+     * until an exit. Blocks are chained, so this returns only for the exits.
+     */
+    if (table[state.pc] == nullptr) compile(state.pc);
+    protect(true);
+    state.table = table.data();
+    auto entry = reinterpret_cast<int (*)(State*, void*)>(buffer);
+    return static_cast<Exit>(entry(&state, table[state.pc]));
+}
+
+void HackJit::chain(int site, int target) {
+    /**
+     * Compiles the target of an EXIT_CHAIN and patches the jump at the site
+     * to go there directly from now on.
+     */
+    int before = generation;
+    if (table[target] == nullptr) compile(target);
+    if (generation == before) {
+        protect(false);
+        patch(sites[site].offset, static_cast<uint8_t*>(table[target]) - buffer);
+    }
+}
+
+#endif
+
+long long HackComputer::runJit(long long maxCycles) {
+    /**
+     * Same as run, with the blocks compiled to x86-64 by HackJit. The block
+     * cache lives as long as the ROM. Whatever the compiled code leaves to
+     * the host is done here: compiling and chaining blocks, the last few
+     * cycles of the budget, and with an I/O handler every instruction that
+     * touches the screen or keyboard, which is interpreted after the handler
+     * has seen its address.
+     * @return the number of instructions executed
+     */
+#if defined(__x86_64__) && defined(__linux__)
+    if (!jit) {
+        jit = std::make_shared<HackJit>(code, static_cast<bool>(ioHandler));
+    }
+    if (!jit->available()) {
+        return runThreaded(maxCycles);
+    }
+    HackJit::State state{ram.data(), jit->blocks(), maxCycles, registerA, registerD, pc, 0};
+    long long interpreted = 0;
+    isHalted = false;
+    while (true) {
+        HackJit::Exit exit = jit->enter(state);
+        if (exit == HackJit::EXIT_CHAIN) {
+            jit->chain(state.site, state.pc);
+            continue;
+        }
+        if (exit == HackJit::EXIT_MISS) continue; //enter compiles it
+
+        registerA = static_cast<int16_t>(state.a);
+        registerD = static_cast<int16_t>(state.d);
+        pc = static_cast<uint16_t>(state.pc);
+        if (exit == HackJit::EXIT_HALT) {
+            isHalted = true;
+            break;
+        }
+        if (exit == HackJit::EXIT_BUDGET) {
+            interpreted += run(state.budget); //less than one block left
+            break;
+        }
+        ioHandler(registerA & 0x7FFF);
+        state.budget -= run(1);
+        state.a = registerA;
+        state.d = registerD;
+        state.pc = pc;
+    }
+    return maxCycles - state.budget + interpreted;
+#else
+    return runThreaded(maxCycles);
+#endif
+}
+
+int HackComputer::jitBlocks() const {
+#if defined(__x86_64__) && defined(__linux__)
+    return jit && jit->available() ? jit->compiledBlocks() : 0;
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,365 @@
+#include "hacktranspiler.h"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+//the generated program keeps A, D and the cycles left in locals of one function, run:
+//every block is a label L<address> that starts by taking its length off the budget,
+//a computed jump sets pc and goes to dispatch, a switch over the block addresses.
+//Any other address, and a block with too few cycles left, goes to step, which
+//interprets one instruction from the ROM kept in the program.
+
+HackTranspiler::HackTranspiler(const HackComputer& computer)
+    : rom(computer.getROM()), code(computer.getCode()), hasHalt(computer.hasHaltLoop()), leaders(), markers() {
+    findLeaders();
+}
+
+void HackTranspiler::findLeaders() {
+    /**
+     * A block starts at 0, after every jump, at every halt loop and at every
+     * constant of an A-instruction that is a ROM address: constant targets
+     * are jumped to directly, and return addresses pushed as constants are
+     * found by the dispatch switch. Constants that are only data make
+     * blocks shorter but are not wrong.
+     */
+    int size = static_cast<int>(rom.size());
+    leaders.assign(size, false);
+    if (size == 0) return;
+    leaders[0] = true;
+    for (int address = 0; address < size; address++) {
+        const HackComputer::MicroOp& op = code[address];
+        if (op.kind == HackComputer::Kind::LOAD_A || op.kind == HackComputer::Kind::HALT) {
+            if (op.value < size) leaders[op.value] = true;
+        } else if (op.jump != 0 && address + 1 < size) {
+            leaders[address + 1] = true;
+        }
+    }
+}
+
+void HackTranspiler::loadMap(const std::string& fileName) {
+    /**
+     * Reads a source map of the assembler (--source-map): "address marker"
+     * per line. The markers become comments in the generated code.
+     */
+    std::ifstream file(fileName);
+    if (!file.is_open()) {
+        throw std::runtime_error("Could not open map file: " + fileName);
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line.compare(0, 2, "//") == 0) continue;
+        std::istringstream fields(line);
+        int address;
+        if (!(fields >> address)) {
+            throw std::runtime_error("Invalid line in map file " + fileName + ": " + line);
+        }
+        std::string marker;
+        std::getline(fields >> std::ws, marker);
+        markers[address] = marker;
+    }
+}
+
+int HackTranspiler::blocks() const {
+    int count = 0;
+    for (bool leader : leaders) count += leader;
+    return count;
+}
+
+std::string HackTranspiler::computation(const HackComputer::MicroOp& op, const std::string& memory) {
+    /**
+     * C++ expression for the comp field of a C-instruction, memory is the
+     * expression that reads M.
+     */
+    using Kind = HackComputer::Kind;
+    switch (op.kind) {
+        case Kind::ZERO: return "0";
+        case Kind::ONE: return "1";
+        case Kind::NEG_ONE: return "-1";
+        case Kind::D: return "D";
+        case Kind::A: return "A";
+        case Kind::NOT_D: return "~D";
+        case Kind::NOT_A: return "~A";
+        case Kind::NEG_D: return "-D";
+        case Kind::NEG_A: return "-A";
+        case Kind::D_PLUS_1: return "D + 1";
+        case Kind::A_PLUS_1: return "A + 1";
+        case Kind::D_MINUS_1: return "D - 1";
+        case Kind::A_MINUS_1: return "A - 1";
+        case Kind::D_PLUS_A: return "D + A";
+        case Kind::D_MINUS_A: return "D - A";
+        case Kind::A_MINUS_D: return "A - D";
+        case Kind::D_AND_A: return "D & A";
+        case Kind::D_OR_A: return "D | A";
+        case Kind::M: return memory;
+        case Kind::NOT_M: return "~" + memory;
+        case Kind::NEG_M: return "-" + memory;
+        case Kind::M_PLUS_1: return memory + " + 1";
+        case Kind::M_MINUS_1: return memory + " - 1";
+        case Kind::D_PLUS_M: return "D + " + memory;
+        case Kind::D_MINUS_M: return "D - " + memory;
+        case Kind::M_MINUS_D: return memory + " - D";
+        case Kind::D_AND_M: return "D & " + memory;
+        case Kind::D_OR_M: return "D | " + memory;
+        default: return "alu(" + std::to_string(op.alu) + ", D, " + ((op.alu & 0x40) ? memory : std::string("A")) + ")";
+    }
+}
+
+void HackTranspiler::write(const std::string& fileName, const std::string& sourceName) {
+    std::ofstream file(fileName);
+    if (!file.is_open()) {
+        throw std::runtime_error("Could not open output file: " + fileName);
+    }
+    write(file, sourceName);
+}
+
+void HackTranspiler::write(std::ostream& output, const std::string& sourceName) {
+    writeRuntime(output, sourceName);
+
+    output << "static long long run(long long maxCycles, int& pc, int16_t& a, int16_t& d, bool& halted) {\n";
+    output << "    int16_t A = a, D = d, out;\n";
+    output << "    int target;\n";
+    output << "    long long left = maxCycles;\n";
+    output << "    halted = false;\n";
+    output << "dispatch:\n";
+    output << "    switch (pc) {\n";
+    for (size_t address = 0; address < leaders.size(); address++) {
+        if (leaders[address]) output << "        case " << address << ": goto L" << address << ";\n";
+    }
+    output << "        default: goto step;\n";
+    output << "    }\n";
+    output << "step: //one instruction from the ROM\n";
+    output << "    {\n";
+    output << "        if (left < 1) goto done;\n";
+    output << "        left--;\n";
+    output << "        uint16_t word = pc < ROM_WORDS ? rom[pc] : 0;\n";
+    output << "        if (!(word & 0x8000)) {\n";
+    output << "            A = static_cast<int16_t>(word);\n";
+    output << "            pc = (pc + 1) & 0x7FFF;\n";
+    output << "            goto dispatch;\n";
+    output << "        }\n";
+    output << "        int control = (word >> 6) & 0x7F;\n";
+    output << "        target = A & 0x7FFF;\n";
+    output << "        out = alu(control, D, (control & 0x40) ? readM(target) : A);\n";
+    output << "        if (word & 0x08) writeM(target, out);\n";
+    output << "        if (word & 0x10) D = out;\n";
+    output << "        if (word & 0x20) A = out;\n";
+    output << "        pc = (pc + 1) & 0x7FFF;\n";
+    output << "        if (word & (out < 0 ? 4 : (out == 0 ? 2 : 1))) pc = target;\n";
+    output << "        goto dispatch;\n";
+    output << "    }\n";
+
+    int address = 0;
+    int size = static_cast<int>(rom.size());
+    while (address < size) {
+        if (!leaders[address]) { //after a halt loop, only reached through step
+            address++;
+            continue;
+        }
+        int next = writeBlock(output, address);
+        if (next >= size || !leaders[next]) {
+            output << "    pc = " << (next & 0x7FFF) << ";\n";
+            output << "    goto dispatch;\n";
+        }
+        address = next;
+    }
+
+    output << "done:\n";
+    output << "    a = A;\n";
+    output << "    d = D;\n";
+    output << "    return maxCycles - left;\n";
+    output << "}\n";
+    output << "\n";
+    writeMain(output);
+}
+
+int HackTranspiler::writeBlock(std::ostream& output, int start) const {
+    /**
+     * Writes the block at start: up to the next block or including the first
+     * jump. A is followed while it holds a constant, so @R13 M=D is a store
+     * to a fixed word and @LOOP 0;JMP a goto.
+     */
+    using Kind = HackComputer::Kind;
+    int size = static_cast<int>(rom.size());
+    auto marker = markers.find(start);
+    output << "L" << start << ":";
+    if (marker != markers.end()) output << " //" << marker->second;
+    output << "\n";
+
+    if (code[start].kind == Kind::HALT) { //halted only with a cycle left, as in the emulator
+        output << "    pc = " << start << ";\n";
+        output << "    halted = left > 0;\n";
+        output << "    goto done;\n";
+        return start + 1;
+    }
+
+    int end = start;
+    do {
+        end++;
+    } while (end < size && !leaders[end] && (code[end - 1].kind == Kind::LOAD_A || code[end - 1].jump == 0));
+    int length = end - start;
+    output << "    if (left < " << length << ") { pc = " << start << "; goto step; }\n";
+    output << "    left -= " << length << ";\n";
+
+    int knownA = -1;
+    for (int address = start; address < end; address++) {
+        const HackComputer::MicroOp& op = code[address];
+        marker = markers.find(address);
+        if (address != start && marker != markers.end()) output << "    //" << marker->second << "\n";
+        if (op.kind == Kind::LOAD_A) {
+            output << "    A = " << op.value << ";\n";
+            knownA = op.value;
+            continue;
+        }
+
+        std::string location = knownA >= 0 ? std::to_string(knownA & 0x7FFF) : "A & 0x7FFF";
+        std::string memory;
+        if (knownA < 0 || (knownA & 0x7FFF) == HackComputer::KBD) {
+            memory = "readM(" + location + ")";
+        } else {
+            memory = "hackRAM[" + location + "]";
+        }
+        output << "    out = static_cast<int16_t>(" << computation(op, memory) << ");\n";
+        if (op.jump != 0 && knownA < 0 && (op.dest & 4)) {
+            output << "    target = A & 0x7FFF;\n";
+        }
+        if (op.dest & 1) {
+            int fixed = knownA & 0x7FFF;
+            if (knownA >= 0 && (fixed < HackComputer::SCREEN || fixed >= HackComputer::KBD)) {
+                output << "    hackRAM[" << fixed << "] = out;\n";
+            } else {
+                output << "    writeM(" << location << ", out);\n";
+            }
+        }
+        int jumpA = knownA; //jumps go to A before this instruction writes it
+        if (op.dest & 2) output << "    D = out;\n";
+        if (op.dest & 4) {
+            output << "    A = out;\n";
+            knownA = -1;
+        }
+        if (op.jump == 0) continue;
+
+        static const char* const conditions[8] = {"", "out > 0", "out == 0", "out >= 0", "out < 0", "out != 0", "out <= 0", ""};
+        std::string jump;
+        int fixed = jumpA & 0x7FFF;
+        if (jumpA >= 0 && fixed < size && leaders[fixed]) {
+            jump = "goto L" + std::to_string(fixed) + ";";
+        } else if (jumpA >= 0) {
+            jump = "{ pc = " + std::to_string(fixed) + "; goto dispatch; }";
+        } else {
+            jump = (op.dest & 4) ? "{ pc = target; goto dispatch; }" : "{ pc = A & 0x7FFF; goto dispatch; }";
+        }
+        if (op.jump == 7) {
+            output << "    " << jump << "\n";
+        } else {
+            output << "    if (" << conditions[op.jump] << ") " << jump << "\n";
+        }
+    }
+    return end;
+}
+
+void HackTranspiler::writeRuntime(std::ostream& output, const std::string& sourceName) const {
+    output << "//" << sourceName << " translated to C++ by hackemulator --transpile\n";
+    output << "//build: g++ -O2 -o program program.cpp\n";
+    output << "//with -DHACK_EXTERNAL_RUNTIME, hackKeyboard and hackScreen come from another file\n";
+    output << "#include <cstdint>\n";
+    output << "#include <climits>\n";
+    output << "#include <iostream>\n";
+    output << "#include <string>\n";
+    output << "#include <vector>\n";
+    output << "#include <utility>\n";
+    output << "#include <stdexcept>\n";
+    output << "\n";
+    output << "int16_t hackRAM[32769]; //RAM as in the emulator, screen at 16384, keyboard at 24576\n";
+    output << "int16_t hackKeyboard(); //read on every load from the keyboard\n";
+    output << "void hackScreen(int address, int16_t value); //called after every store to the screen\n";
+    output << "\n";
+    output << "#ifndef HACK_EXTERNAL_RUNTIME\n";
+    output << "int16_t hackKeyboard() { return hackRAM[24576]; }\n";
+    output << "void hackScreen(int, int16_t) {}\n";
+    output << "#endif\n";
+    output << "\n";
+    output << "static const bool HAS_HALT = " << (hasHalt ? "true" : "false") << ";\n";
+    output << "static const int ROM_WORDS = " << rom.size() << ";\n";
+    output << "static const uint16_t rom[" << (rom.empty() ? 1 : rom.size()) << "] = {";
+    for (size_t address = 0; address < rom.size(); address++) {
+        output << (address % 16 == 0 ? "\n    " : " ") << rom[address] << ",";
+    }
+    output << "\n};\n";
+    output << "\n";
+    output << "static int16_t alu(int control, int16_t x, int16_t y) {\n";
+    output << "    if (control & 0b100000) x = 0;\n";
+    output << "    if (control & 0b010000) x = ~x;\n";
+    output << "    if (control & 0b001000) y = 0;\n";
+    output << "    if (control & 0b000100) y = ~y;\n";
+    output << "    int16_t out = (control & 0b000010) ? static_cast<int16_t>(x + y) : static_cast<int16_t>(x & y);\n";
+    output << "    return (control & 0b000001) ? static_cast<int16_t>(~out) : out;\n";
+    output << "}\n";
+    output << "\n";
+    output << "static inline int16_t readM(int address) {\n";
+    output << "    if (address == 24576) hackRAM[24576] = hackKeyboard();\n";
+    output << "    return hackRAM[address];\n";
+    output << "}\n";
+    output << "\n";
+    output << "static inline void writeM(int address, int16_t value) {\n";
+    output << "    hackRAM[address] = value;\n";
+    output << "    if (static_cast<unsigned>(address - 16384) < 8192) hackScreen(address, value);\n";
+    output << "}\n";
+    output << "\n";
+}
+
+void HackTranspiler::writeMain(std::ostream& output) const {
+    /**
+     * The options and output of the emulator, so a translated ROM can
+     * replace it in a test suite: -c, -s, -k and -d.
+     */
+    output << "int main(int argc, char* argv[]) {\n";
+    output << "    long long maxCycles = -1;\n";
+    output << "    std::vector<std::pair<int, int>> dumps;\n";
+    output << "    try {\n";
+    output << "        for (int i = 1; i < argc; i++) {\n";
+    output << "            std::string arg = argv[i];\n";
+    output << "            if (i + 1 >= argc) throw std::invalid_argument(arg + \" requires a value\");\n";
+    output << "            std::string value = argv[++i];\n";
+    output << "            if (arg == \"-c\" || arg == \"--cycles\") {\n";
+    output << "                maxCycles = std::stoll(value);\n";
+    output << "            } else if (arg == \"-s\" || arg == \"--set\") {\n";
+    output << "                size_t equals = value.find('=');\n";
+    output << "                if (equals == std::string::npos) throw std::invalid_argument(arg + \" \" + value);\n";
+    output << "                int address = std::stoi(value.substr(0, equals));\n";
+    output << "                if (address < 0 || address > 24576) throw std::out_of_range(arg + \" \" + value);\n";
+    output << "                hackRAM[address] = static_cast<int16_t>(std::stoi(value.substr(equals + 1)));\n";
+    output << "            } else if (arg == \"-k\" || arg == \"--key\") {\n";
+    output << "                hackRAM[24576] = static_cast<int16_t>(std::stoi(value));\n";
+    output << "            } else if (arg == \"-d\" || arg == \"--dump\") {\n";
+    output << "                size_t dash = value.find('-', 1);\n";
+    output << "                int first = std::stoi(value.substr(0, dash));\n";
+    output << "                int last = dash == std::string::npos ? first : std::stoi(value.substr(dash + 1));\n";
+    output << "                if (first < 0 || first > last || last > 24576) throw std::out_of_range(arg + \" \" + value);\n";
+    output << "                dumps.emplace_back(first, last);\n";
+    output << "            } else {\n";
+    output << "                throw std::invalid_argument(arg + \" \" + value);\n";
+    output << "            }\n";
+    output << "        }\n";
+    output << "    } catch (const std::exception& e) {\n";
+    output << "        std::cerr << \"ERROR: Invalid arguments: \" << e.what() << std::endl;\n";
+    output << "        std::cerr << \"Usage: \" << argv[0] << \" [-c CYCLES] [-s A=V] [-k CODE] [-d A[-B]]\" << std::endl;\n";
+    output << "        return 1;\n";
+    output << "    }\n";
+    output << "    if (maxCycles < 0 && !HAS_HALT) {\n";
+    output << "        std::cerr << \"ERROR: The program has no halt loop, give the number of cycles with -c/--cycles\" << std::endl;\n";
+    output << "        return 1;\n";
+    output << "    }\n";
+    output << "\n";
+    output << "    int pc = 0;\n";
+    output << "    int16_t a = 0, d = 0;\n";
+    output << "    bool halted = false;\n";
+    output << "    long long cycles = run(maxCycles < 0 ? LLONG_MAX : maxCycles, pc, a, d, halted);\n";
+    output << "    std::cout << (halted ? \"Halted\" : \"Stopped\") << \" after \" << cycles << \" cycles at PC \" << pc << std::endl;\n";
+    output << "    for (const auto& dump : dumps) {\n";
+    output << "        for (int address = dump.first; address <= dump.second; address++) {\n";
+    output << "            std::cout << \"RAM[\" << address << \"] = \" << hackRAM[address] << std::endl;\n";
+    output << "        }\n";
+    output << "    }\n";
+    output << "    return 0;\n";
+    output << "}\n";
+}
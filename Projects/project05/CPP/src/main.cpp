@@ -0,0 +1,281 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <utility>
+#include <chrono>
+#include <climits>
+#include <filesystem>
+#include <map>
+#include "hackcomputer.h"
+#include "hacktranspiler.h"
+
+void showHelp(const char* programName) {
+    std::cout << std::endl;
+    std::cout << "Usage: " << programName << " [OPTIONS] [FILE|-]" << std::endl;
+    std::cout << std::endl;
+    std::cout << "OPTIONS:" << std::endl;
+    std::cout << " -f, --file FILE   | Specify input .hack file" << std::endl;
+    std::cout << " -c, --cycles N    | Run at most N cycles (default: until the halt loop)" << std::endl;
+    std::cout << " -d, --dump A[-B]  | Print RAM[A..B] after the run, can be repeated" << std::endl;
+    std::cout << " -s, --set A=V     | Set RAM[A] = V before the run, can be repeated" << std::endl;
+    std::cout << " -k, --key CODE    | Hold a key down: RAM[24576] = CODE" << std::endl;
+    std::cout << " -e, --engine E    | threaded (default, superinstructions), switch or jit (x86-64)" << std::endl;
+    std::cout << " -b, --benchmark   | Run with every engine, compare the results and the speed" << std::endl;
+    std::cout << " -t, --transpile F | Write the program as C++ to F instead of running it" << std::endl;
+    std::cout << " -m, --map FILE    | Source map of the assembler, comments for --transpile" << std::endl;
+    std::cout << " -v, --verbose     | Enable Verbose Output (run time, speed, JIT blocks and I/O exits)" << std::endl;
+    std::cout << " -h, --help        | Show this help message" << std::endl;
+    std::cout << std::endl;
+    std::cout << " Files can also be provided as positional arguments, - reads stdin" << std::endl;
+    std::cout << " A halt loop is @k at ROM address k followed by 0;JMP" << std::endl;
+}
+
+int parseNumber(const std::string& text) {
+    size_t end = 0;
+    int value = std::stoi(text, &end);
+    if (end != text.size()) {
+        throw std::invalid_argument(text);
+    }
+    return value;
+}
+
+long long runEngine(HackComputer& computer, const std::string& engine, long long limit) {
+    if (engine == "switch") return computer.run(limit);
+    if (engine == "jit") return computer.runJit(limit);
+    return computer.runThreaded(limit);
+}
+
+std::string engineName(const std::string& engine) {
+    if (engine == "switch") return "Switch";
+    if (engine == "jit") return "JIT";
+    return "Threaded";
+}
+
+int main(int argc, char* argv[]) {
+    bool verbose = false;
+    bool showHelpFlag = false;
+    std::string inputFile;
+    long long maxCycles = -1;
+    std::vector<std::pair<int, int>> dumps; //first and last address
+    std::vector<std::pair<int, int>> sets; //address, value
+    int key = 0;
+    std::string engine = "threaded";
+    bool benchmark = false;
+    std::string transpileFile;
+    std::string mapFile;
+
+    // Parse command line arguments
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+
+            if (arg == "-f" || arg == "--file") {
+                if (!hasValue) {
+                    std::cerr << "ERROR: -f/--file requires a file argument" << std::endl;
+                    return 1;
+                }
+                inputFile = argv[++i];
+            } else if (arg == "-c" || arg == "--cycles") {
+                if (!hasValue) {
+                    std::cerr << "ERROR: -c/--cycles requires a number" << std::endl;
+                    return 1;
+                }
+                maxCycles = std::stoll(argv[++i]);
+            } else if (arg == "-d" || arg == "--dump") {
+                if (!hasValue) {
+                    std::cerr << "ERROR: -d/--dump requires an address or range A-B" << std::endl;
+                    return 1;
+                }
+                std::string range = argv[++i];
+                size_t dash = range.find('-', 1);
+                int first = parseNumber(range.substr(0, dash));
+                int last = dash == std::string::npos ? first : parseNumber(range.substr(dash + 1));
+                dumps.emplace_back(first, last);
+            } else if (arg == "-s" || arg == "--set") {
+                if (!hasValue) {
+                    std::cerr << "ERROR: -s/--set requires A=V" << std::endl;
+                    return 1;
+                }
+                std::string assignment = argv[++i];
+                size_t equals = assignment.find('=');
+                if (equals == std::string::npos) {
+                    std::cerr << "ERROR: -s/--set requires A=V, got " << assignment << std::endl;
+                    return 1;
+                }
+                sets.emplace_back(parseNumber(assignment.substr(0, equals)), parseNumber(assignment.substr(equals + 1)));
+            } else if (arg == "-k" || arg == "--key") {
+                if (!hasValue) {
+                    std::cerr << "ERROR: -k/--key requires a key code" << std::endl;
+                    return 1;
+                }
+                key = parseNumber(argv[++i]);
+            } else if (arg == "-e" || arg == "--engine") {
+                engine = hasValue ? argv[++i] : "";
+                if (engine != "threaded" && engine != "switch" && engine != "jit") {
+                    std::cerr << "ERROR: -e/--engine must be threaded, switch or jit" << std::endl;
+                    return 1;
+                }
+            } else if (arg == "-t" || arg == "--transpile") {
+                if (!hasValue) {
+                    std::cerr << "ERROR: -t/--transpile requires an output file" << std::endl;
+                    return 1;
+                }
+                transpileFile = argv[++i];
+            } else if (arg == "-m" || arg == "--map") {
+                if (!hasValue) {
+                    std::cerr << "ERROR: -m/--map requires a map file" << std::endl;
+                    return 1;
+                }
+                mapFile = argv[++i];
+            } else if (arg == "-b" || arg == "--benchmark") {
+                benchmark = true;
+            } else if (arg == "-v" || arg == "--verbose") {
+                verbose = true;
+            } else if (arg == "-h" || arg == "--help") {
+                showHelpFlag = true;
+            } else if (arg[0] == '-' && arg != "-") {
+                std::cerr << "ERROR: Unknown option " << arg << std::endl;
+                showHelp(argv[0]);
+                return 1;
+            } else {
+                if (inputFile.empty()) {
+                    inputFile = arg;
+                } else {
+                    std::cerr << "ERROR: Multiple files specified. Use only one file." << std::endl;
+                    return 1;
+                }
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "ERROR: Invalid number in arguments: " << e.what() << std::endl;
+        return 1;
+    }
+
+    // Show help if requested
+    if (showHelpFlag) {
+        showHelp(argv[0]);
+        return 0;
+    }
+
+    // Check if required file argument is provided
+    if (inputFile.empty()) {
+        std::cerr << "ERROR: Input file is required. Specify with -f/--file or as a positional argument" << std::endl;
+        return 1;
+    }
+
+    if (inputFile != "-") {
+        // Check if file exists
+        if (!std::filesystem::exists(inputFile)) {
+            std::cerr << "ERROR: File '" << inputFile << "' does not exist" << std::endl;
+            return 1;
+        }
+
+        // Check if file is a .hack
+        if (inputFile.substr(inputFile.find_last_of('.') + 1) != "hack") {
+            std::cerr << "ERROR: File must have .hack extension" << std::endl;
+            return 1;
+        }
+    }
+
+    if (!mapFile.empty() && transpileFile.empty()) {
+        std::cerr << "ERROR: -m/--map is only used with -t/--transpile" << std::endl;
+        return 1;
+    }
+
+    try {
+        HackComputer computer;
+        computer.loadROM(inputFile);
+        if (!transpileFile.empty()) {
+            HackTranspiler transpiler(computer);
+            if (!mapFile.empty()) {
+                transpiler.loadMap(mapFile);
+            }
+            transpiler.write(transpileFile, inputFile == "-" ? "stdin" : std::filesystem::path(inputFile).filename().string());
+            if (verbose) {
+                std::cout << "Wrote " << transpileFile << ": " << computer.getROM().size() << " words of ROM in "
+                          << transpiler.blocks() << " blocks" << std::endl;
+            }
+            return 0;
+        }
+        if (maxCycles < 0 && !computer.hasHaltLoop()) {
+            std::cerr << "ERROR: The program has no halt loop, give the number of cycles with -c/--cycles" << std::endl;
+            return 1;
+        }
+        for (const auto& set : sets) {
+            computer.poke(set.first, static_cast<int16_t>(set.second));
+        }
+        computer.setKey(static_cast<int16_t>(key));
+        for (const auto& dump : dumps) { //check the ranges before a long run
+            if (dump.first > dump.second) {
+                throw std::runtime_error("Empty RAM range: " + std::to_string(dump.first) + "-" + std::to_string(dump.second));
+            }
+            computer.peek(dump.first);
+            computer.peek(dump.second);
+        }
+
+        if (verbose) {
+            std::cout << "Running " << inputFile << ": " << computer.getROM().size() << " words of ROM, "
+                      << computer.superinstructions() << " superinstructions" << std::endl;
+        }
+        long long limit = maxCycles < 0 ? LLONG_MAX : maxCycles;
+        HackComputer initial; //same program and RAM for the other engines
+        if (benchmark) {
+            initial = computer;
+        }
+        long long ioExits = 0;
+        if (verbose && engine == "jit") {
+            computer.setIOHandler([&ioExits](int) { ioExits++; });
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        long long cycles = runEngine(computer, engine, limit);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        std::cout << (computer.halted() ? "Halted" : "Stopped") << " after " << cycles << " cycles at PC " << computer.getPC() << std::endl;
+        if ((verbose || benchmark) && elapsed.count() > 0) {
+            std::cout << engineName(engine) << ": " << elapsed.count() << " s, "
+                      << cycles / elapsed.count() / 1e6 << " million instructions per second" << std::endl;
+        }
+        if (verbose && engine == "jit") {
+            std::cout << "Compiled blocks: " << computer.jitBlocks() << ", screen and keyboard exits: " << ioExits << std::endl;
+        }
+
+        if (benchmark) {
+            std::map<std::string, double> seconds{{engine, elapsed.count()}};
+            for (const std::string other : {"switch", "threaded", "jit"}) {
+                if (other == engine) continue;
+                HackComputer baseline = initial;
+                start = std::chrono::steady_clock::now();
+                long long baselineCycles = runEngine(baseline, other, limit);
+                std::chrono::duration<double> baselineElapsed = std::chrono::steady_clock::now() - start;
+                seconds[other] = baselineElapsed.count();
+                std::cout << engineName(other) << ": " << baselineElapsed.count() << " s, "
+                          << baselineCycles / baselineElapsed.count() / 1e6 << " million instructions per second" << std::endl;
+
+                bool same = baselineCycles == cycles && baseline.getPC() == computer.getPC() && baseline.halted() == computer.halted() &&
+                            baseline.getA() == computer.getA() && baseline.getD() == computer.getD();
+                for (int address = 0; same && address < HackComputer::RAM_SIZE; address++) {
+                    same = baseline.peek(address) == computer.peek(address);
+                }
+                if (!same) {
+                    std::cerr << "ERROR: The " << other << " and " << engine << " engines disagree on the final state" << std::endl;
+                    return 1;
+                }
+            }
+            std::cout << "Threaded speedup: " << seconds["switch"] / seconds["threaded"] << "x" << std::endl;
+            std::cout << "JIT speedup: " << seconds["switch"] / seconds["jit"] << "x" << std::endl;
+        }
+        for (const auto& dump : dumps) {
+            for (int address = dump.first; address <= dump.second; address++) {
+                std::cout << "RAM[" << address << "] = " << computer.peek(address) << std::endl;
+            }
+        }
+
+    } catch (const std::exception& e) {
+        std::cerr << "ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
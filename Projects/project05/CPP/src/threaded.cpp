@@ -0,0 +1,177 @@
+#include "hackcomputer.h"
+
+//computations in the order of HackComputer::Kind after LOAD_A and HALT, with the
+//expression for each, the registers are the locals of runThreaded
+#define HACK_COMPUTATIONS(X) \
+    X(ZERO, 0) X(ONE, 1) X(NEG_ONE, -1) X(D, d) X(A, a) X(NOT_D, ~d) X(NOT_A, ~a) X(NEG_D, -d) X(NEG_A, -a) \
+    X(D_PLUS_1, d + 1) X(A_PLUS_1, a + 1) X(D_MINUS_1, d - 1) X(A_MINUS_1, a - 1) X(D_PLUS_A, d + a) \
+    X(D_MINUS_A, d - a) X(A_MINUS_D, a - d) X(D_AND_A, d & a) X(D_OR_A, d | a) \
+    X(M, memory[a & 0x7FFF]) X(NOT_M, ~memory[a & 0x7FFF]) X(NEG_M, -memory[a & 0x7FFF]) \
+    X(M_PLUS_1, memory[a & 0x7FFF] + 1) X(M_MINUS_1, memory[a & 0x7FFF] - 1) X(D_PLUS_M, d + memory[a & 0x7FFF]) \
+    X(D_MINUS_M, d - memory[a & 0x7FFF]) X(M_MINUS_D, memory[a & 0x7FFF] - d) X(D_AND_M, d & memory[a & 0x7FFF]) \
+    X(D_OR_M, d | memory[a & 0x7FFF]) \
+    X(ALU, alu(ip->op.alu, d, (ip->op.alu & 0x40) ? memory[a & 0x7FFF] : a))
+
+static const int KIND_COUNT = 2 + 29; //LOAD_A, HALT and the computations
+static_assert(static_cast<int>(HackComputer::Kind::ALU) == KIND_COUNT - 1, "HACK_COMPUTATIONS must follow Kind");
+
+void HackComputer::fuse() {
+    /**
+     * Builds the superinstruction table for runThreaded. An A-instruction and
+     * the C-instruction after it become one entry, @v A=M-1 and @v AM=M-1
+     * (the stack idioms of the VM translator) take the C-instruction after
+     * them along as well. Every address keeps its own entry, so a jump into
+     * the middle of a fused sequence runs the rest of it unfused.
+     */
+    const uint16_t topWord = 0xFCA0; //A=M-1
+    const uint16_t popWord = 0xFCA8; //AM=M-1
+
+    threaded.assign(ROM_SIZE + 1, ThreadedOp{nullptr, code[0], Fusion::NONE, 1});
+    threadedReady = false;
+    fusedCount = 0;
+    for (size_t address = 0; address < ROM_SIZE; address++) {
+        ThreadedOp& entry = threaded[address];
+        entry.op = code[address];
+        bool isLoad = code[address].kind == Kind::LOAD_A;
+        if (!isLoad || address + 1 >= rom.size() || !(rom[address + 1] & 0x8000)) continue;
+
+        uint16_t second = rom[address + 1];
+        bool thirdIsC = address + 2 < rom.size() && (rom[address + 2] & 0x8000);
+        if ((second == topWord || second == popWord) && thirdIsC) {
+            entry.fusion = second == topWord ? Fusion::TOP : Fusion::POP;
+            entry.length = 3;
+        } else {
+            entry.fusion = Fusion::LOAD;
+            entry.length = 2;
+        }
+        entry.op = code[address + entry.length - 1];
+        entry.op.value = rom[address];
+        fusedCount++;
+    }
+    threaded[ROM_SIZE].length = 0; //past the end: continue at 0, see runThreaded
+}
+
+long long HackComputer::runThreaded(long long maxCycles) {
+    /**
+     * Same as run, with direct threading: every entry of threaded holds the
+     * address of its handler and every handler ends in its own indirect jump
+     * to the next one, instead of going back to a shared switch. Each
+     * computation has a handler per fusion, so a superinstruction needs one
+     * dispatch. Needs the labels as values extension of GCC and Clang, other
+     * compilers use run.
+     * @return the number of instructions executed
+     */
+#if defined(__GNUC__)
+#define NONE_LABEL(kind, expression) &&NONE_##kind,
+#define LOAD_LABEL(kind, expression) &&LOAD_##kind,
+#define TOP_LABEL(kind, expression) &&TOP_##kind,
+#define POP_LABEL(kind, expression) &&POP_##kind,
+    static const void* const handlers[] = { //[fusion][kind]
+        &&LOAD_A_HANDLER, &&HALT_HANDLER, HACK_COMPUTATIONS(NONE_LABEL)
+        &&LOAD_A_HANDLER, &&HALT_HANDLER, HACK_COMPUTATIONS(LOAD_LABEL)
+        &&LOAD_A_HANDLER, &&HALT_HANDLER, HACK_COMPUTATIONS(TOP_LABEL)
+        &&LOAD_A_HANDLER, &&HALT_HANDLER, HACK_COMPUTATIONS(POP_LABEL)
+    };
+    static_assert(sizeof(handlers) / sizeof(handlers[0]) == 4 * KIND_COUNT, "one handler per fusion and kind");
+
+    if (!threadedReady) {
+        for (ThreadedOp& entry : threaded) {
+            entry.handler = handlers[static_cast<int>(entry.fusion) * KIND_COUNT + static_cast<int>(entry.op.kind)];
+        }
+        threaded[ROM_SIZE].handler = &&WRAP_HANDLER;
+        threadedReady = true;
+    }
+
+    int16_t a = registerA;
+    int16_t d = registerD;
+    int16_t* memory = ram.data();
+    ThreadedOp* program = threaded.data();
+    const ThreadedOp* ip = program + pc;
+    long long cycles = 0;
+    bool halt = false;
+    int16_t out;
+    uint16_t target;
+
+//stops before an entry that would go past maxCycles, run finishes the last few
+#define DISPATCH() \
+    if (cycles + ip->length > maxCycles) goto done; \
+    goto *ip->handler
+
+//dest and jump of the last instruction, as in run
+#define FINISH() \
+    target = a & 0x7FFF; \
+    memory[(ip->op.dest & 1) ? target : SCRATCH] = out; \
+    d = (ip->op.dest & 2) ? out : d; \
+    a = (ip->op.dest & 4) ? out : a; \
+    cycles += ip->length; \
+    if (ip->op.jump != 0 && (ip->op.jump & (out < 0 ? 4 : (out == 0 ? 2 : 1)))) { \
+        ip = program + target; \
+    } else { \
+        ip += ip->length; \
+    } \
+    DISPATCH()
+
+#define NONE_HANDLER(kind, expression) \
+    NONE_##kind: \
+        out = static_cast<int16_t>(expression); \
+        FINISH();
+#define LOAD_HANDLER(kind, expression) \
+    LOAD_##kind: \
+        a = static_cast<int16_t>(ip->op.value); \
+        out = static_cast<int16_t>(expression); \
+        FINISH();
+#define TOP_HANDLER(kind, expression) \
+    TOP_##kind: \
+        a = static_cast<int16_t>(memory[ip->op.value] - 1); \
+        out = static_cast<int16_t>(expression); \
+        FINISH();
+#define POP_HANDLER(kind, expression) \
+    POP_##kind: \
+        a = static_cast<int16_t>(memory[ip->op.value] - 1); \
+        memory[ip->op.value] = a; \
+        out = static_cast<int16_t>(expression); \
+        FINISH();
+
+    DISPATCH();
+
+LOAD_A_HANDLER:
+    a = static_cast<int16_t>(ip->op.value);
+    cycles++;
+    ip++;
+    DISPATCH();
+WRAP_HANDLER:
+    ip = program;
+    DISPATCH();
+HALT_HANDLER:
+    halt = true;
+    goto done;
+
+    HACK_COMPUTATIONS(NONE_HANDLER)
+    HACK_COMPUTATIONS(LOAD_HANDLER)
+    HACK_COMPUTATIONS(TOP_HANDLER)
+    HACK_COMPUTATIONS(POP_HANDLER)
+
+done:
+    registerA = a;
+    registerD = d;
+    pc = static_cast<uint16_t>((ip - program) & 0x7FFF);
+    isHalted = halt;
+    if (!halt && cycles < maxCycles) {
+        cycles += run(maxCycles - cycles); //less than one superinstruction left
+    }
+    return cycles;
+
+#undef NONE_LABEL
+#undef LOAD_LABEL
+#undef TOP_LABEL
+#undef POP_LABEL
+#undef DISPATCH
+#undef FINISH
+#undef NONE_HANDLER
+#undef LOAD_HANDLER
+#undef TOP_HANDLER
+#undef POP_HANDLER
+#else
+    return run(maxCycles);
+#endif
+}
@@ -2,6 +2,7 @@
 #define ASSEMBLER_H
 
 #include <string>
+#include <ostream>
 #include "parser.h"
 #include "code.h"
 #include "symboltable.h"
@@ -17,13 +18,14 @@ class Assembler {
         bool isNumber(const std::string& str);
         std::string toBinary(int value, int bits = 15);
         void firstPass();
-        void secondPass(const std::string& outputFile);
+        void secondPass(std::ostream& output, const std::string& mapFile);
         void verboseOutput(const std::string& message);
 
     public:
         Assembler(const std::string& inputFile, bool verbose = false);
 
-        void assemble(const std::string& outputFile);
+        void assemble(const std::string& outputFile, const std::string& mapFile = "");
+        void assemble(std::ostream& output, const std::string& mapFile = "");
         void printSymbolTable() const;
 };
 
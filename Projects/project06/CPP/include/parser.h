@@ -14,14 +14,16 @@ enum class InstructionType {
 class Parser {
     private:
         std::vector<std::string> lines;
+        std::vector<std::string> markers; //text of the last //@ source marker before each line
         size_t currentLine;
         std::string currentInstruction;
 
         std::string trim(const std::string &str);
         std::string removeComments(const std::string& line);
+        void read(std::istream& input);
 
     public:
-        Parser(const std::string& str);
+        Parser(const std::string& str); //"-" reads stdin
 
         bool hasMoreCommands();
         void advance();
@@ -30,6 +32,7 @@ class Parser {
         std::string dest();   // For C_INSTRUCTION
         std::string comp();   // For C_INSTRUCTION
         std::string jump();   // For C_INSTRUCTION
+        std::string marker(); // Source marker of the current instruction, empty if none
 
         void reset(); //reset to beginning
         const std::vector<std::string>& getLines() const { return lines; }
@@ -42,16 +42,21 @@ void Assembler::firstPass() {
     verboseOutput("First pass complete. Found " + std::to_string(pc) + " instructions");
 }
 
-void Assembler::secondPass(const std::string& outputFile) {
+void Assembler::secondPass(std::ostream& output, const std::string& mapFile) {
     verboseOutput("Step 2: Second pass = translating instructions...");
 
-    std::ofstream output(outputFile);
-    if (!output.is_open()) {
-        throw std::runtime_error("Could not open output file: " + outputFile);
+    std::ofstream map;
+    if (!mapFile.empty()) {
+        map.open(mapFile);
+        if (!map.is_open()) {
+            throw std::runtime_error("Could not open map file: " + mapFile);
+        }
+        map << "// address marker, each line covers the ROM up to the next address" << std::endl;
     }
 
     parser.reset();
     int pc = 0;
+    std::string lastMarker;
 
     while (parser.hasMoreCommands()) {
         parser.advance();
@@ -99,18 +104,42 @@ void Assembler::secondPass(const std::string& outputFile) {
             verboseOutput("C-instruction: " + destMnemonic + "=" + compMnemonic + ";" + jumpMnemonic + " -> " + binaryInstruction);            
         }
 
+        if (map.is_open() && parser.marker() != lastMarker) {
+            lastMarker = parser.marker();
+            map << pc << " " << lastMarker << std::endl;
+        }
+
         output << binaryInstruction << std::endl;
         pc++;
     }
 
-    output.close();
+    output.flush();
     verboseOutput("Assembly complete!");
     verboseOutput("Generated " + std::to_string(pc) + " machine code instructions.");
 }
 
-void Assembler::assemble(const std::string& outputFile) {
+void Assembler::assemble(const std::string& outputFile, const std::string& mapFile) {
+    /**
+     * Assembles the input into outputFile. If mapFile is given, also writes a
+     * source map: the ROM address where the text of each "//@ text" marker
+     * comment starts to apply, one line per change. The VM translator writes
+     * markers of the form "Main.vm:12 Main.jack:4 push local 0".
+     */
+    std::ofstream output(outputFile);
+    if (!output.is_open()) {
+        throw std::runtime_error("Could not open output file: " + outputFile);
+    }
+    assemble(output, mapFile);
+}
+
+void Assembler::assemble(std::ostream& output, const std::string& mapFile) {
+    /**
+     * Assembles the input into a stream, ex. std::cout. Labels can be used
+     * before they are defined, so nothing is written before the whole input
+     * has been read.
+     */
     firstPass();
-    secondPass(outputFile);
+    secondPass(output, mapFile);
 }
 
 void Assembler::printSymbolTable() const {
@@ -35,7 +35,9 @@ void Code::initializeTables() {
     compTable["D-A"] = "0010011";
     compTable["A-D"] = "0000111";
     compTable["D&A"] = "0000000";
+    compTable["A&D"] = "0000000";
     compTable["D|A"] = "0010101";
+    compTable["A|D"] = "0010101";
     
     // Computation table (a=1)
     compTable["M"] = "1110000";
@@ -48,7 +50,9 @@ void Code::initializeTables() {
     compTable["D-M"] = "1010011";
     compTable["M-D"] = "1000111";
     compTable["D&M"] = "1000000";
+    compTable["M&D"] = "1000000";
     compTable["D|M"] = "1010101";
+    compTable["M|D"] = "1010101";
     
     // Jump table
     jumpTable[""] = "000";
@@ -6,27 +6,31 @@
 
 void showHelp(const char* programName) {
     std::cout << std::endl;
-    std::cout << "Usage: " << programName << " [OPTIONS] [FILE]" << std::endl;
+    std::cout << "Usage: " << programName << " [OPTIONS] [FILE|-]" << std::endl;
     std::cout << std::endl;
     std::cout << "OPTIONS:" << std::endl;
     std::cout << " -f, --file FILE | Specify input .asm file" << std::endl;
+    std::cout << " -o, --output F  | Write the machine code to F, - for stdout (default for stdin)" << std::endl;
     std::cout << " -v, --verbose   | Enable Verbose Output" << std::endl;
+    std::cout << " --source-map    | Write a .map from ROM address to the //@ source markers" << std::endl;
     std::cout << " -h, --help      | Show this help message" << std::endl;
     std::cout << std::endl;
-    std::cout << " Files can also be provided as positional arguments" << std::endl;
+    std::cout << " Files can also be provided as positional arguments, - reads stdin" << std::endl;
 }
 
 int main(int argc, char* argv[]) {
     bool verbose = false;
+    bool sourceMap = false;
     bool showHelpFlag = false;
     std::string inputFile;
+    std::string outputFile;
     
     // Parse command line arguments
     for (int i = 1; i < argc; i++) {
         std::string arg = argv[i];
         
         if (arg == "-f" || arg == "--file") {
-            if (i + 1 < argc && argv[i + 1][0] != '-') {
+            if (i + 1 < argc && (argv[i + 1][0] != '-' || std::strcmp(argv[i + 1], "-") == 0)) {
                 inputFile = argv[++i];
             } else {
                 std::cerr << "ERROR: -f/--file requires a file argument" << std::endl;
@@ -34,11 +38,20 @@ int main(int argc, char* argv[]) {
             }
         } else if (arg.substr(0, 7) == "--file=") {
             inputFile = arg.substr(7);
+        } else if (arg == "-o" || arg == "--output") {
+            if (i + 1 < argc) {
+                outputFile = argv[++i];
+            } else {
+                std::cerr << "ERROR: -o/--output requires a file argument" << std::endl;
+                return 1;
+            }
         } else if (arg == "-v" || arg == "--verbose") {
             verbose = true;
+        } else if (arg == "--source-map") {
+            sourceMap = true;
         } else if (arg == "-h" || arg == "--help") {
             showHelpFlag = true;
-        } else if (arg[0] == '-') {
+        } else if (arg[0] == '-' && arg != "-") {
             std::cerr << "ERROR: Unknown option " << arg << std::endl;
             showHelp(argv[0]);
             return 1;
@@ -64,41 +77,69 @@ int main(int argc, char* argv[]) {
         return 1;
     }
     
-    // Check if file exists
-    if (!std::filesystem::exists(inputFile)) {
-        std::cerr << "ERROR: File '" << inputFile << "' does not exist" << std::endl;
-        return 1;
+    if (inputFile != "-") {
+        // Check if file exists
+        if (!std::filesystem::exists(inputFile)) {
+            std::cerr << "ERROR: File '" << inputFile << "' does not exist" << std::endl;
+            return 1;
+        }
+
+        // Check if file is a .asm
+        if (inputFile.substr(inputFile.find_last_of('.') + 1) != "asm") {
+            std::cerr << "ERROR: File must have .asm extension" << std::endl;
+            return 1;
+        }
     }
     
-    // Check if file is a .asm
-    if (inputFile.substr(inputFile.find_last_of('.') + 1) != "asm") {
-        std::cerr << "ERROR: File must have .asm extension" << std::endl;
-        return 1;
+    // Create output file name (.hack), stdin goes to stdout
+    if (outputFile.empty() && inputFile == "-") {
+        outputFile = "-";
+    } else if (outputFile.empty()) {
+        outputFile = inputFile;
+        size_t lastDot = outputFile.find_last_of('.');
+        if (lastDot != std::string::npos) {
+            outputFile = outputFile.substr(0, lastDot) + ".hack";
+        } else {
+            outputFile += ".hack";
+        }
     }
-    
-    // Create output file name (.hack)
-    std::string outputFile = inputFile;
-    size_t lastDot = outputFile.find_last_of('.');
-    if (lastDot != std::string::npos) {
-        outputFile = outputFile.substr(0, lastDot) + ".hack";
-    } else {
-        outputFile += ".hack";
+    bool toStdout = outputFile == "-";
+    if (toStdout && sourceMap) {
+        std::cerr << "ERROR: --source-map writes a map next to the output file, it needs -o FILE" << std::endl;
+        return 1;
     }
     
     if (verbose) {
         std::cerr << "Assembling " << inputFile << " --> " << outputFile << std::endl;
     }
     
+    // The machine code owns stdout, messages go to stderr instead
+    std::streambuf* standardOutput = std::cout.rdbuf();
+    if (toStdout) {
+        std::cout.rdbuf(std::cerr.rdbuf());
+    }
+
     try {
         Assembler assembler(inputFile, verbose);
-        assembler.assemble(outputFile);
+        std::string mapFile = sourceMap ? outputFile.substr(0, outputFile.find_last_of('.')) + ".map" : "";
+        if (toStdout) {
+            std::ostream output(standardOutput);
+            assembler.assemble(output, mapFile);
+        } else {
+            assembler.assemble(outputFile, mapFile);
+        }
         
-        std::cout << "Assembly successful! Generated " << outputFile << std::endl;
+        std::cout << "Assembly successful! Generated " << (toStdout ? "stdout" : outputFile) << std::endl;
+        if (sourceMap) {
+            std::cout << "Source map written to " << mapFile << std::endl;
+        }
         
     } catch (const std::exception& e) {
+        std::cout.rdbuf(standardOutput);
         std::cerr << "ERROR: " << e.what() << std::endl;
         return 1;
     }
+    std::cout.rdbuf(standardOutput);
     
     return 0;
 }
\ No newline at end of file
@@ -4,19 +4,34 @@
 #include <cctype> 
 
 Parser::Parser(const std::string& filename) : currentLine(0) {
+    if (filename == "-") {
+        read(std::cin);
+        return;
+    }
     std::ifstream file(filename);
     if (!file.is_open()) {
         throw std::runtime_error("Could not open file: " + filename);
     }
+    read(file);
+    file.close();
+}
 
+void Parser::read(std::istream& input) {
     std::string line;
-    while (std::getline(file, line)) {
+    std::string marker;
+    while (std::getline(input, line)) {
+        //"//@ text" comments mark where the code after them came from, see Assembler::assemble
+        std::string trimmed = trim(line);
+        if (trimmed.compare(0, 3, "//@") == 0) {
+            marker = trim(trimmed.substr(3));
+            continue;
+        }
         line = trim(removeComments(line));
         if (!line.empty()) {
             lines.push_back(line);
+            markers.push_back(marker);
         }
     }
-    file.close();
 }
 
 std::string Parser::trim(const std::string& str) {
@@ -108,6 +123,10 @@ std::string Parser::jump() {
     return "";
 }
 
+std::string Parser::marker() {
+    return currentLine > 0 ? markers[currentLine - 1] : "";
+}
+
 void Parser::reset() {
     currentLine = 0;
     currentInstruction = "";
@@ -2,6 +2,7 @@
 #include <cassert>
 #include <string>
 #include <vector>
+#include <sstream>
 #include "parser.h"
 #include "code.h"
 #include "symboltable.h"
@@ -30,6 +31,8 @@ void test_code_module(){
     assert(code.comp("M") == "1110000");
     assert(code.comp("D+A") == "0000010");
     assert(code.comp("D+M") == "1000010");
+    assert(code.comp("M&D") == code.comp("D&M")); //the VM translator writes both orders
+    assert(code.comp("M|D") == code.comp("D|M"));
 
     //test jump code
     assert(code.jump("") == "000");
@@ -187,12 +190,89 @@ void test_full_assembly() {
     std::cout << "Full assembly tests passed!" << std::endl;
 }
 
+void test_source_map() {
+    std::cout << "Testing source map..." << std::endl;
+
+    //create a test file with source markers
+    std::ofstream testFile("test_map.asm");
+    testFile << "//@ - - bootstrap\n";
+    testFile << "@256\n";
+    testFile << "D=A\n";
+    testFile << "//@ Main.vm:2 Main.jack:5 push constant 7\n";
+    testFile << "(Main.main)\n";   // Labels take no ROM
+    testFile << "@7\n";           // Marker starts at address 2
+    testFile << "// plain comments are not markers\n";
+    testFile << "D=A\n";
+    testFile << "//@ Main.vm:2 Main.jack:5 push constant 7\n";
+    testFile << "@SP\n";          // Same marker again, no new line
+    testFile.close();
+
+    Assembler assembler("test_map.asm", false);
+    assembler.assemble("test_map.hack", "test_map.map");
+
+    std::ifstream mapFile("test_map.map");
+    std::vector<std::string> expectedMap = {
+        "0 - - bootstrap",
+        "2 Main.vm:2 Main.jack:5 push constant 7"
+    };
+
+    std::string line;
+    std::getline(mapFile, line); //header comment
+    assert(line.substr(0, 2) == "//");
+    size_t lineNum = 0;
+    while (std::getline(mapFile, line)) {
+        assert(lineNum < expectedMap.size());
+        assert(line == expectedMap[lineNum]);
+        lineNum++;
+    }
+    assert(lineNum == expectedMap.size());
+    mapFile.close();
+
+    // Markers must not change the machine code
+    std::ifstream outputFile("test_map.hack");
+    int instructions = 0;
+    while (std::getline(outputFile, line)) {
+        instructions++;
+    }
+    assert(instructions == 5);
+    outputFile.close();
+
+    std::remove("test_map.asm");
+    std::remove("test_map.hack");
+    std::remove("test_map.map");
+
+    std::cout << "Source map tests passed!" << std::endl;
+}
+
+void test_stream_output() {
+    std::cout << "Testing assembly to a stream..." << std::endl;
+
+    //forward label, the stream gets nothing until the whole input is read
+    std::ofstream testFile("test_stream.asm");
+    testFile << "@END\n";
+    testFile << "0;JMP\n";
+    testFile << "(END)\n";
+    testFile << "@END\n";
+    testFile.close();
+
+    Assembler assembler("test_stream.asm", false);
+    std::ostringstream output;
+    assembler.assemble(output);
+    assert(output.str() == "0000000000000010\n1110101010000111\n0000000000000010\n");
+
+    std::remove("test_stream.asm");
+
+    std::cout << "Stream output tests passed!" << std::endl;
+}
+
 int main() {
     try {
         test_code_module();
         test_symbol_table_module();
         test_parser_with_sample_file();
         test_full_assembly();
+        test_source_map();
+        test_stream_output();
 
         std::remove("test_input.asm");
         std::remove("test_program.asm");
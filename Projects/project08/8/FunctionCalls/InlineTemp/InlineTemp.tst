@@ -0,0 +1,15 @@
+// Tests InlineTemp.asm in the CPU emulator.
+// This assembly file results from translating the InlineTemp folder.
+
+load InlineTemp.asm,
+output-file InlineTemp.out,
+compare-to InlineTemp.cmp,
+
+set RAM[0] 256,
+
+repeat 1000 {
+	ticktock;
+}
+
+output-list RAM[0]%D1.6.1 RAM[261]%D1.6.1 RAM[262]%D1.6.1;
+output;
@@ -0,0 +1,14 @@
+// Tests and illustrates the inlining temp test on the VM emulator.
+
+load,  // loads all the VM files from the current folder
+output-file InlineTemp.out,
+compare-to InlineTemp.cmp,
+
+set sp 261,
+
+repeat 12 {
+	vmstep;
+}
+
+output-list RAM[0]%D1.6.1 RAM[261]%D1.6.1 RAM[262]%D1.6.1;
+output;
@@ -0,0 +1,21 @@
+// Tests LoopAtStart.asm on the CPU emulator.
+// Before executing the code, initializes the stack pointer
+// and the base addresses of the local and argument segments,
+// and sets argument[0] to 0: the loop body must not run.
+
+load LoopAtStart.asm,
+output-file LoopAtStart.out,
+compare-to LoopAtStart.cmp,
+
+set RAM[0] 256,  // SP
+set RAM[1] 300,  // LCL
+set RAM[2] 400,  // ARG
+set RAM[400] 0,  // argument 0
+
+repeat 200 {
+	ticktock;
+}
+
+// Outputs the stack pointer and the value at the stack's base
+output-list RAM[0]%D1.6.1 RAM[256]%D1.6.1;
+output;
@@ -0,0 +1,21 @@
+// Tests and illustrates LoopAtStart.vm on the VM emulator.
+// Before executing the code, initializes the stack pointer
+// and the base addresses of the local and argument segments,
+// and sets argument[0] to 0: the loop body must not run.
+
+load LoopAtStart.vm,
+output-file LoopAtStart.out,
+compare-to LoopAtStart.cmp,
+
+set sp 256,
+set local 300,
+set argument 400,
+set argument[0] 0,
+
+repeat 6 {
+ 	vmstep;
+}
+
+// Outputs the stack pointer and the value at the stack's base
+output-list RAM[0]%D1.6.1 RAM[256]%D1.6.1;
+output;
@@ -0,0 +1,30 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <string>
+
+class TranslationCache {
+    /**
+     * Per file cache of generated assembly, see --cache. Entries are files in
+     * a directory named by a hash of the .vm file's name and contents, the
+     * translator options and the translator build, so a stale entry is never
+     * found, only left behind.
+     */
+    private:
+        std::string directory;
+        std::string options; //everything besides the file that changes its code
+        int hits;
+        int misses;
+
+        std::string entryPath(const std::string& key) const;
+
+    public:
+        TranslationCache(const std::string& directory, const std::string& options);
+
+        std::string key(const std::string& vmFile) const;
+        bool lookup(const std::string& key, std::string& code);
+        void store(const std::string& key, const std::string& code);
+        std::string summary() const;
+};
+
+#endif // CACHE_H
@@ -0,0 +1,57 @@
+#ifndef CALLGRAPH_H
+#define CALLGRAPH_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include "vmparser.h"
+
+struct FunctionInfo {
+    bool defined = false; //false for functions that are called but not in any file
+    int numLocals = 0;
+    int numArgs = -1; //largest argument count at any call site, -1 if never called
+    bool setsPointer = false; //pops into pointer 0 or 1, changing THIS/THAT
+    bool returnsValue = false; //some return is not right after push constant 0
+    bool resultUsed = false; //some call to it is not right before pop temp 0
+    std::set<std::string> callees;
+};
+
+struct StaticFrame {
+    /**
+     * Fixed RAM block that replaces the stack frame of a non recursive function:
+     * return address, caller SP, THIS, THAT, then arguments and locals.
+     */
+    int base;
+    int numArgs;
+    int numLocals;
+
+    int returnAddress() const { return base; }
+    int savedSP() const { return base + 1; }
+    int savedThis() const { return base + 2; }
+    int savedThat() const { return base + 3; }
+    int argument(int index) const { return base + 4 + index; }
+    int local(int index) const { return base + 4 + numArgs + index; }
+    int size() const { return 4 + numArgs + numLocals; }
+};
+
+class CallGraph {
+    private:
+        std::map<std::string, FunctionInfo> functions;
+        std::vector<std::vector<std::string>> components; //strongly connected components, callees before callers
+        std::set<std::string> recursive;
+
+        void findComponents();
+
+    public:
+        CallGraph(const std::vector<VMFile>& files);
+
+        bool isRecursive(const std::string& name) const;
+        const std::map<std::string, FunctionInfo>& getFunctions() const { return functions; }
+        std::map<std::string, StaticFrame> allocateStaticFrames(int top, int budget) const;
+        std::set<std::string> findLightFunctions() const;
+        std::set<std::string> findVoidFunctions() const;
+        std::map<std::string, int> allocateProfileSlots(int top, int bottom, int words) const;
+};
+
+#endif // CALLGRAPH_H
@@ -0,0 +1,55 @@
+#ifndef CFG_H
+#define CFG_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include "vmparser.h"
+
+struct BasicBlock {
+    std::string label; //label that starts the block, "" if it is only entered by falling through
+    std::vector<VMCommand> body; //commands after the label, the last one may be goto, if-goto or return
+    bool reachable;
+};
+
+class ControlFlowGraph {
+    private:
+        std::vector<BasicBlock> blocks;
+        std::map<std::string, size_t> labelBlock; //label -> index of the block it starts
+
+        void build(const std::vector<VMCommand>& commands);
+        void index();
+        std::vector<size_t> successors(size_t block) const;
+        size_t nextNonEmpty(size_t block) const;
+        std::string resolve(const std::string& label) const;
+        bool isBooleanCondition(const std::vector<VMCommand>& body) const;
+
+        bool threadJumps();
+        bool foldConstantBranches();
+        bool invertBranches();
+        bool removeFallthroughGotos();
+        bool removeUnreachable();
+        bool removeUnusedLabels();
+
+        //block layout
+        std::string functionName;
+        std::map<std::string, long> profile; //Function$label -> times reached, see Optimizer::readProfile
+        long count(const std::string& label) const;
+        std::string uniqueLabel(const std::string& base) const;
+        void invertCondition(std::vector<VMCommand>& body, const std::string& target) const;
+        bool canFallThrough(size_t block) const;
+        bool rotateLoop(size_t header);
+        bool swapArms(size_t branch);
+
+    public:
+        ControlFlowGraph(const std::vector<VMCommand>& commands);
+
+        bool simplify();
+        int layout(const std::map<std::string, long>& labelCounts);
+        size_t blockCount() const;
+        std::vector<VMCommand> commands() const;
+
+        static std::vector<std::vector<VMCommand>> splitFunctions(const std::vector<VMCommand>& commands);
+};
+
+#endif // CFG_H
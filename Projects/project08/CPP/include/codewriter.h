@@ -3,27 +3,115 @@
 
 #include <string>
 #include <fstream>
+#include <map>
+#include <set>
+#include <memory>
+#include "callgraph.h"
+#include "report.h"
 
 class CodeWriter {
     private:
-        std::ofstream outputFile;
+        std::ofstream file; //owned output file, unused when writing to a stream
+        std::ostream outputFile; //where the assembly goes, no buffer once closed
+        std::unique_ptr<InstructionCounter> counter; //between outputFile and its buffer while counting, see countInstructions
         std::string currentFileName;
         std::string currentFunction;
         int labelCounter;
         int callCounter;
+        bool cacheTop; //keep the top of stack in D between commands
+        bool topInD; //true while the logical top of stack lives in D instead of RAM
+        int registerCount; //values below the cached top held in R13.., the deepest in R13, see writeRegisterPush
+        bool batchSP; //track pushes and pops as an offset from RAM[SP] within a basic block
+        int spOffset; //logical SP = RAM[SP] + spOffset
+        std::map<std::string, StaticFrame> staticFrames; //non recursive functions with fixed frames
+        const StaticFrame* currentFrame; //frame of the function being written, nullptr if it uses the stack
+        std::set<std::string> lightFunctions; //functions called without saving THIS/THAT
+        std::set<std::string> voidFunctions; //functions that return nothing, their callers do not pop a value
+        bool currentLight; //the function being written uses the 3 word frame
+        bool tailCallUsed; //emit the shared TAIL_CALL routine on close
+        bool multiplyUsed; //emit the shared MATH_MULTIPLY routine on close
+        bool divideUsed; //emit the shared MATH_DIVIDE routine on close
+        std::map<std::string, int> profileSlots; //function -> address of its call counter, empty if not profiling
+        int profileClock; //address of the clock register read on entry and exit, -1 for call counts only
+        bool sourceMap; //write //@ markers for the assembler's source map
+        bool fileLabels; //prefix generated labels with the file name, so a file's code can be reused on its own
+        bool nativeOS; //call the hand written versions of OS functions, see nativeos.h
+        std::set<std::string> nativeUsed; //shared native routines to emit on close
+
+        std::string labelPrefix();
 
         std::string generateLabel(const std::string& prefix);
         void writeComparison(const std::string& jumpType);
         void writePushSegment(const std::string& segment, int index);
         void writePopSegment(const std::string& segment, int index);
 
+        //top of stack caching helpers
+        void spillTop();
+        void loadTop();
+        void flushRegisters();
+        void writeCachedArithmetic(const std::string& command);
+        void writeCachedPush(const std::string& segment, int index);
+        void writeCachedPop(const std::string& segment, int index);
+
+        //batched stack pointer helpers
+        void flushSP();
+        void writeStackAddress(int offset);
+        void writeBatchedArithmetic(const std::string& command);
+        void writeBatchedPush(const std::string& segment, int index);
+        void writeBatchedPop(const std::string& segment, int index);
+
+        //segment addressing helpers
+        std::string segmentBase(const std::string& segment);
+        bool isDirectSlot(const std::string& segment, int index);
+        void writeAddress(const std::string& segment, int index, bool keepD);
+        void writeLoadD(const std::string& segment, int index);
+        void writeStoreD(const std::string& segment, int index);
+        std::string jumpFor(const std::string& command, bool negate);
+        int staticSlot(const std::string& segment, int index);
+
+        //native OS routines
+        bool writeNativeCall(const std::string& functionName, int numArgs);
+        void writeNativeRoutine(const std::string& functionName);
+        void writeFrameCall(const std::string& functionName, int numArgs);
+
+        //static frame calling convention
+        void writeStaticCall(const std::string& functionName, int numArgs, const StaticFrame& frame);
+        void writeStaticReturn();
+        void writeTailCallRoutine();
+        void writeMultiplyRoutine();
+        void writeDivideRoutine();
+
+        //profiling instrumentation
+        void writeProfileEntry();
+        void writeProfileExit();
+
     public:
         CodeWriter(const std::string& outputFileName);
+        CodeWriter(std::streambuf* output);
         ~CodeWriter();
 
         void setFileName(const std::string& fileName);
+        void setCacheTop(bool enabled);
+        void setBatchSP(bool enabled);
+        void setStaticFrames(const std::map<std::string, StaticFrame>& frames);
+        void setLightFunctions(const std::set<std::string>& functions);
+        void setProfile(const std::map<std::string, int>& slots, int clock);
+        void setSourceMap(bool enabled);
+        void writeMarker(const std::string& text);
+        void setFileLabels(bool enabled);
+        void setNativeOS(bool enabled);
+        void setVoidFunctions(const std::set<std::string>& functions);
+        bool isVoid(const std::string& functionName) const { return voidFunctions.count(functionName) > 0; }
+        bool returnsVoid() const { return isVoid(currentFunction); }
+        void writeVoidCall(const std::string& functionName, int numArgs);
+        bool hasNative(const std::string& functionName, int numArgs) const;
+        void countInstructions();
+        long instructionCount() const;
+        std::streampos filePosition();
+        void writeCached(const std::string& code);
         void writeArithmetic(const std::string& command);
         void writePushPop(const std::string& command, const std::string& segment, int index);
+        void flush();
         void close();
         
         //chapter 8 additions
@@ -34,6 +122,22 @@ class CodeWriter {
         void writeCall(const std::string& functionName, int numArgs);
         void writeReturn();
         void writeFunction(const std::string& functionName, int numLocals);
+        void writeTailCall(const std::string& functionName, int numArgs);
+
+        //fused command sequences, see Fuser
+        bool canUpdateInPlace(const std::string& segment, int index) { return isDirectSlot(segment, index); }
+        void writeCompareJump(const std::string& command, bool negate, const std::string& label);
+        void writeConstantCompareJump(const std::string& command, int constant, bool negate, const std::string& label);
+        void writeNotJump(const std::string& label);
+        void writeMove(const std::string& srcSegment, int srcIndex, const std::string& dstSegment, int dstIndex);
+        void writeSlotUpdate(const std::string& segment, int index, const std::string& command, int constant);
+        void writeConstantArithmetic(const std::string& command, int constant);
+        void writeRegisterPush(const std::string& segment, int index);
+
+        //inline Math calls, see Fuser::writeInlineMath
+        void writeConstantMultiply(int constant);
+        void writeMultiply();
+        void writeDivide();
 };
 
 #endif // CODEWRITER_H
\ No newline at end of file
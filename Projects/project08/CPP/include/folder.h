@@ -0,0 +1,24 @@
+#ifndef FOLDER_H
+#define FOLDER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include "vmparser.h"
+
+class FunctionFolder {
+    private:
+        std::map<std::string, std::string> aliases; //folded function -> the copy that is kept
+
+        std::string normalize(const std::vector<VMCommand>& commands, size_t start, size_t end, const std::string& file);
+        bool foldOnce(std::vector<VMFile>& program);
+
+    public:
+        int fold(std::vector<VMFile>& program);
+        const std::map<std::string, std::string>& getAliases() const { return aliases; }
+        std::string report(const std::map<std::string, int>& functionWords) const;
+
+        static std::map<std::string, int> countWords(const std::string& asmFile, const std::vector<VMFile>& program);
+};
+
+#endif // FOLDER_H
@@ -0,0 +1,25 @@
+#ifndef FUSER_H
+#define FUSER_H
+
+#include <vector>
+#include "vmparser.h"
+#include "codewriter.h"
+
+class Fuser {
+    private:
+        CodeWriter& codeWriter;
+
+        bool isComparison(const VMCommand& command);
+        bool isArithmetic(const VMCommand& command, const std::string& name);
+        bool isCall(const VMCommand& command, const std::string& name);
+
+    public:
+        Fuser(CodeWriter& codeWriter);
+
+        size_t writeFused(const std::vector<VMCommand>& commands, size_t pos);
+        size_t writeInlineMath(const std::vector<VMCommand>& commands, size_t pos);
+        size_t writeVoidCalls(const std::vector<VMCommand>& commands, size_t pos);
+        size_t writeRegisterPush(const std::vector<VMCommand>& commands, size_t pos);
+};
+
+#endif // FUSER_H
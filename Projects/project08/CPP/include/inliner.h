@@ -0,0 +1,40 @@
+#ifndef INLINER_H
+#define INLINER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include "vmparser.h"
+
+struct InlineCandidate {
+    /**
+     * A small leaf function whose body can replace its call sites.
+     */
+    size_t file; //index of the file that defines it, static accesses only work there
+    int numLocals;
+    std::vector<VMCommand> body; //without the function command and the final return
+    bool usesStatic;
+    bool setsThis; //writes pointer 0, THIS has to be restored after the body
+    bool setsThat; //writes pointer 1
+    int sites = 0; //call sites replaced
+    int cyclesSaved = 0; //estimated, summed over the call sites
+};
+
+class Inliner {
+    private:
+        size_t maxSize; //largest body, in commands, that is inlined
+        std::map<std::string, InlineCandidate> candidates;
+
+        bool findCandidate(const std::vector<VMCommand>& commands, size_t start, size_t file);
+        static int slotsNeeded(const InlineCandidate& candidate, int numArgs);
+        bool expand(const InlineCandidate& candidate, int numArgs, int base, std::vector<VMCommand>& out);
+        int estimateSaving(const InlineCandidate& candidate, int numArgs) const;
+
+    public:
+        Inliner(size_t maxSize = 8);
+
+        void inlineCalls(std::vector<VMFile>& program);
+        std::string report() const;
+};
+
+#endif // INLINER_H
@@ -0,0 +1,22 @@
+#ifndef NATIVEOS_H
+#define NATIVEOS_H
+
+#include <string>
+#include <map>
+
+struct NativeRoutine {
+    /**
+     * Hand written Hack assembly for an OS function, used in place of the
+     * compiled one. On entry the arguments are the top numArgs words of the
+     * stack, on exit they are replaced by the return value, like a VM call.
+     * In code, $ stands for a label prefix unique to the routine or the call.
+     */
+    int numArgs;
+    std::string guard; //jump on the last argument that needs the compiled function (ex. JLT), empty if none
+    bool shared; //code is written once and entered with the return address in R15, otherwise inlined at each call
+    std::string code;
+};
+
+const std::map<std::string, NativeRoutine>& nativeRoutines(); //OS function name -> routine
+
+#endif // NATIVEOS_H
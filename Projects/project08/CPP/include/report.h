@@ -0,0 +1,75 @@
+#ifndef REPORT_H
+#define REPORT_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <streambuf>
+#include "vmparser.h"
+
+class InstructionCounter : public std::streambuf {
+    /**
+     * Passes everything written on to another buffer, counting Hack
+     * instructions: lines that are not blank, comments or labels.
+     */
+    private:
+        std::streambuf* target;
+        long count;
+        bool lineStart; //nothing but blanks on the current line so far
+
+        void scan(char c);
+
+    protected:
+        int overflow(int c) override;
+        std::streamsize xsputn(const char* s, std::streamsize n) override;
+        int sync() override;
+        std::streampos seekoff(std::streamoff off, std::ios_base::seekdir dir, std::ios_base::openmode which) override;
+
+    public:
+        InstructionCounter(std::streambuf* target);
+        long instructions() const { return count; }
+};
+
+class CodeReport {
+    private:
+        struct OpcodeCost {
+            long commands = 0;
+            long words = 0;
+        };
+        struct LoopCost {
+            std::string label;
+            int commands;
+            long cycles;
+        };
+        struct FunctionCost {
+            long commands = 0;
+            long words = 0;
+            long entryWords = 0; //the function command: label and locals
+            long returnWords = 0; //all return commands
+            int returns = 0;
+            std::vector<LoopCost> loops;
+        };
+
+        std::map<std::string, OpcodeCost> opcodes;
+        std::map<std::string, FunctionCost> functions;
+        std::map<std::string, std::pair<long, int>> callSites; //callee -> words at all its call sites, number of sites
+        std::string current; //function being recorded
+        std::vector<std::pair<VMCommand, long>> body; //commands of the current function and their words
+        long bootstrapWords;
+        long sharedWords;
+        long totalWords;
+
+        static std::string opcode(const VMCommand& command);
+        static std::string quote(const std::string& str);
+        void endFunction();
+
+    public:
+        CodeReport();
+
+        void add(const std::vector<VMCommand>& commands, size_t pos, size_t used, long words, const std::string& kind = "");
+        void setBootstrap(long words) { bootstrapWords = words; }
+        void setTotal(long words, long shared) { totalWords = words; sharedWords = shared; }
+        void write(const std::string& fileName);
+};
+
+#endif // REPORT_H
@@ -0,0 +1,50 @@
+#ifndef VMBINARY_H
+#define VMBINARY_H
+
+#include <string>
+#include <vector>
+#include "vmparser.h"
+
+/**
+ * .vmb, the binary form of a .vm file written by the Jack compiler (--binary).
+ * All numbers are little endian.
+ *
+ *   "VMB1"                           magic
+ *   u16 string count                 interned function and label names
+ *     u16 length, bytes              one per string
+ *   u16 source                       string index of the Jack file, 0xFFFF if none
+ *   u32 command count
+ *     u8 opcode, u8 segment,         one 8 byte record per command
+ *     u16 count, u16 value, u16 line
+ *
+ * opcode  0-8 add sub neg eq gt lt and or not, 9 push, 10 pop, 11 label,
+ *         12 goto, 13 if-goto, 14 function, 15 call, 16 return
+ * segment 0-7 constant argument local static this that pointer temp (push/pop)
+ * count   number of locals (function) or arguments (call)
+ * value   index (push/pop), string index of the name (label, jumps, function, call)
+ * line    Jack line of the command, 0 if unknown
+ */
+
+enum class VMBOpcode { //same values as the Command and Opcode enums of the Jack compiler's VMWriter.h
+    ADD,
+    SUB,
+    NEG,
+    EQ,
+    GT,
+    LT,
+    AND,
+    OR,
+    NOT,
+    PUSH,
+    POP,
+    LABEL,
+    GOTO,
+    IF_GOTO,
+    FUNCTION,
+    CALL,
+    RETURN
+};
+
+std::vector<VMCommand> readBinaryVM(const std::string& filename);
+
+#endif // VMBINARY_H
@@ -0,0 +1,43 @@
+#ifndef VMOPTIMIZER_H
+#define VMOPTIMIZER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include "vmparser.h"
+
+class Optimizer {
+    private:
+        int folded; //constant expressions folded
+        int simplified; //algebraic identities removed
+        int propagated; //pushes rewritten by copy propagation
+        int removed; //dead push/pop pairs removed
+        int blocksRemoved; //basic blocks removed by control flow simplification
+        int blocksMoved; //loops rotated and if/else arms swapped by layout
+        bool verbose;
+
+        void verboseOutput(const std::string& message);
+
+        bool readConstant(const std::vector<VMCommand>& commands, size_t pos, int& value, size_t& length);
+        void pushConstant(std::vector<VMCommand>& out, int value);
+        bool isArithmetic(const VMCommand& command, const std::string& name);
+        bool isBlockEnd(const VMCommand& command);
+
+        bool foldConstants(std::vector<VMCommand>& commands);
+        bool simplify(std::vector<VMCommand>& commands);
+        bool propagateCopies(std::vector<VMCommand>& commands);
+        bool removeDeadPairs(std::vector<VMCommand>& commands);
+        bool simplifyControlFlow(std::vector<VMCommand>& commands);
+
+    public:
+        Optimizer(bool verbose = false);
+
+        std::vector<VMCommand> optimize(std::vector<VMCommand> commands);
+        std::vector<VMCommand> layout(const std::vector<VMCommand>& commands, const std::map<std::string, long>& profile);
+        std::string summary() const;
+
+        static std::map<std::string, long> readProfile(const std::string& fileName);
+        static void writeVM(const std::string& fileName, const std::vector<VMCommand>& commands);
+};
+
+#endif // VMOPTIMIZER_H
@@ -18,23 +18,46 @@ enum class CommandType {
     C_UNKNOWN
 };
 
+struct VMCommand {
+    CommandType type;
+    std::string arg1; //segment, label, function name or the arithmetic command itself
+    int arg2; //index, number of locals or number of args, -1 if unused
+    std::string source = ""; //"Main.vm:12 Main.jack:4" (- if no marker), empty for commands made up by an optimization
+};
+
+struct VMFile {
+    std::string path; //the .vm file the commands came from
+    std::vector<VMCommand> commands;
+};
+
+std::string formatCommand(const VMCommand& command); //back to .vm text ex. push local 0
+
 class Parser {
     private:
         std::vector<std::string> lines;
+        std::vector<std::string> sources; //VMCommand::source of each line
         size_t currentLine;
         std::string currentCommand;
+        std::istream* stream; //read a line at a time while commands are needed, nullptr once it is used up
+        std::string name; //file name used in VMCommand::source
+        std::string jackLine; //from the last //@ File.jack:line marker written by the compiler
+        int lineNumber; //lines read so far
 
         std::string trim(const std::string& str);
         std::string removeComments(const std::string& line);
+        bool readLine(std::istream& input);
 
     public:
         Parser(const std::string& filename);
+        Parser(std::istream& input, const std::string& name);
 
         bool hasMoreCommands();
         void advance();
         CommandType commandType();
         std::string arg1();
         int arg2();
+        VMCommand command();
+        std::vector<VMCommand> readAll();
 
         void reset();
         const std::vector<std::string>& getLines() const { return lines; }
@@ -0,0 +1,77 @@
+#include "cache.h"
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <filesystem>
+#include <stdexcept>
+
+//changes with every build of the translator, whose output may have changed with it
+const char* const BUILD = __DATE__ " " __TIME__;
+
+static unsigned long long fnv1a(const std::string& data, unsigned long long hash = 14695981039346656037ULL) {
+    for (unsigned char c : data) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+TranslationCache::TranslationCache(const std::string& directory, const std::string& options)
+    : directory(directory), options(options), hits(0), misses(0) {}
+
+std::string TranslationCache::key(const std::string& vmFile) const {
+    /**
+     * Hash of everything the code of vmFile depends on. The file name is part
+     * of it, static variables and labels are named after the file.
+     * @return 16 hex digits
+     */
+    std::ifstream file(vmFile, std::ios::binary);
+    if (!file.is_open()) throw std::runtime_error("Could not open file: " + vmFile);
+    std::ostringstream contents;
+    contents << file.rdbuf();
+
+    unsigned long long hash = fnv1a(BUILD);
+    hash = fnv1a(options + "\n", hash);
+    hash = fnv1a(std::filesystem::path(vmFile).filename().string() + "\n", hash);
+    hash = fnv1a(contents.str(), hash);
+
+    std::ostringstream key;
+    key << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return key.str();
+}
+
+std::string TranslationCache::entryPath(const std::string& key) const {
+    return (std::filesystem::path(directory) / (key + ".asm")).string();
+}
+
+bool TranslationCache::lookup(const std::string& key, std::string& code) {
+    std::ifstream entry(entryPath(key), std::ios::binary);
+    if (!entry.is_open()) {
+        misses++;
+        return false;
+    }
+    std::ostringstream contents;
+    contents << entry.rdbuf();
+    code = contents.str();
+    hits++;
+    return true;
+}
+
+void TranslationCache::store(const std::string& key, const std::string& code) {
+    //write then rename, so an interrupted run never leaves half an entry behind
+    std::filesystem::create_directories(directory);
+    std::string path = entryPath(key);
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream entry(temporary, std::ios::binary);
+        if (!entry.is_open()) throw std::runtime_error("Could not write cache entry: " + temporary);
+        entry << code;
+    }
+    std::filesystem::rename(temporary, path);
+}
+
+std::string TranslationCache::summary() const {
+    std::ostringstream summary;
+    summary << "Cache: " << hits << " files reused, " << misses << " translated";
+    return summary.str();
+}
@@ -0,0 +1,222 @@
+#include "callgraph.h"
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+
+CallGraph::CallGraph(const std::vector<VMFile>& files) {
+    std::string current;
+    for (const auto& file : files) {
+        const auto& commands = file.commands;
+        for (size_t pos = 0; pos < commands.size(); pos++) {
+            const VMCommand& command = commands[pos];
+            if (command.type == CommandType::C_FUNCTION) {
+                current = command.arg1;
+                functions[current].defined = true;
+                functions[current].numLocals = command.arg2;
+            } else if (command.type == CommandType::C_POP && command.arg1 == "pointer") {
+                functions[current].setsPointer = true;
+            } else if (command.type == CommandType::C_RETURN) {
+                bool zero = pos > 0 && commands[pos - 1].type == CommandType::C_PUSH &&
+                            commands[pos - 1].arg1 == "constant" && commands[pos - 1].arg2 == 0;
+                if (!zero) functions[current].returnsValue = true;
+            } else if (command.type == CommandType::C_CALL) {
+                functions[current].callees.insert(command.arg1);
+                FunctionInfo& callee = functions[command.arg1];
+                callee.numArgs = std::max(callee.numArgs, command.arg2);
+                bool dropped = pos + 1 < commands.size() && commands[pos + 1].type == CommandType::C_POP &&
+                               commands[pos + 1].arg1 == "temp" && commands[pos + 1].arg2 == 0;
+                if (!dropped) callee.resultUsed = true;
+            }
+        }
+    }
+    findComponents();
+}
+
+void CallGraph::findComponents() {
+    /**
+     * Tarjan's algorithm. A function is recursive if its component has more
+     * than one member or if it calls itself.
+     */
+    std::map<std::string, int> indexOf, lowLink;
+    std::set<std::string> onStack;
+    std::vector<std::string> stack;
+    int nextIndex = 0;
+
+    std::function<void(const std::string&)> visit = [&](const std::string& name) {
+        indexOf[name] = lowLink[name] = nextIndex++;
+        stack.push_back(name);
+        onStack.insert(name);
+
+        for (const auto& callee : functions[name].callees) {
+            if (indexOf.count(callee) == 0) {
+                visit(callee);
+                lowLink[name] = std::min(lowLink[name], lowLink[callee]);
+            } else if (onStack.count(callee)) {
+                lowLink[name] = std::min(lowLink[name], indexOf[callee]);
+            }
+        }
+
+        if (lowLink[name] == indexOf[name]) {
+            std::vector<std::string> component;
+            std::string member;
+            do {
+                member = stack.back();
+                stack.pop_back();
+                onStack.erase(member);
+                component.push_back(member);
+            } while (member != name);
+
+            if (component.size() > 1 || functions[name].callees.count(name)) {
+                recursive.insert(component.begin(), component.end());
+            }
+            components.push_back(component);
+        }
+    };
+
+    for (const auto& entry : functions) {
+        if (indexOf.count(entry.first) == 0) visit(entry.first);
+    }
+}
+
+bool CallGraph::isRecursive(const std::string& name) const {
+    return recursive.count(name) > 0;
+}
+
+std::map<std::string, StaticFrame> CallGraph::allocateStaticFrames(int top, int budget) const {
+    /**
+     * Gives every non recursive function that is called somewhere a fixed frame.
+     * Frames are overlaid: a function's frame starts above the frames of every
+     * function that can be active while it runs (its transitive callers), so two
+     * functions that are never active together share the same words.
+     * The block ends just below top. If it needs more than budget words, the
+     * largest frames go back to the stack until it fits.
+     * Sys.init keeps its stack frame, it is entered from the bootstrap code.
+     * @return function name -> frame, absolute addresses
+     */
+    std::set<std::string> candidates;
+    for (const auto& entry : functions) {
+        if (entry.second.defined && entry.second.numArgs >= 0 && !isRecursive(entry.first) && entry.first != "Sys.init") {
+            candidates.insert(entry.first);
+        }
+    }
+
+    while (true) {
+        std::map<std::string, int> base;
+        int total = 0;
+
+        //components are stored callees first, so walk them backwards to visit callers first
+        for (auto component = components.rbegin(); component != components.rend(); ++component) {
+            int start = 0;
+            for (const auto& name : *component) start = std::max(start, base[name]);
+
+            int end = start;
+            if (component->size() == 1 && candidates.count(component->front())) {
+                const FunctionInfo& info = functions.at(component->front());
+                end += 4 + info.numArgs + info.numLocals;
+            }
+            total = std::max(total, end);
+
+            for (const auto& name : *component) {
+                base[name] = start;
+                for (const auto& callee : functions.at(name).callees) {
+                    base[callee] = std::max(base[callee], end);
+                }
+            }
+        }
+
+        if (total <= budget || candidates.empty()) {
+            std::map<std::string, StaticFrame> frames;
+            for (const auto& name : candidates) {
+                const FunctionInfo& info = functions.at(name);
+                frames[name] = {top - total + base[name], info.numArgs, info.numLocals};
+            }
+            return frames;
+        }
+
+        auto largest = std::max_element(candidates.begin(), candidates.end(), [&](const std::string& a, const std::string& b) {
+            return functions.at(a).numArgs + functions.at(a).numLocals < functions.at(b).numArgs + functions.at(b).numLocals;
+        });
+        candidates.erase(largest);
+    }
+}
+
+std::set<std::string> CallGraph::findLightFunctions() const {
+    /**
+     * Finds the functions that leave THIS and THAT unchanged: they never pop into
+     * pointer and everything they can call is defined and does the same. Calls to
+     * them do not need to save and restore THIS/THAT.
+     * Entry points keep the full frame: Sys.init, whose frame the bootstrap lays
+     * out, and functions nothing in the program calls, whose frame is set up
+     * from outside.
+     * Starts from every function that does not set pointer itself and removes
+     * callers of non light functions until nothing changes.
+     */
+    std::set<std::string> light;
+    for (const auto& entry : functions) {
+        if (entry.second.defined && !entry.second.setsPointer && entry.second.numArgs >= 0 && entry.first != "Sys.init") {
+            light.insert(entry.first);
+        }
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto name = light.begin(); name != light.end();) {
+            const auto& callees = functions.at(*name).callees;
+            bool keep = std::all_of(callees.begin(), callees.end(), [&](const std::string& callee) {
+                return light.count(callee) > 0;
+            });
+            if (keep) {
+                ++name;
+            } else {
+                name = light.erase(name);
+                changed = true;
+            }
+        }
+    }
+    return light;
+}
+
+std::set<std::string> CallGraph::findVoidFunctions() const {
+    /**
+     * Finds the functions whose return value is never used: every return
+     * returns constant 0 (a Jack void function) and every call is followed by
+     * pop temp 0 (a do statement). They can return nothing and their callers
+     * skip the pop. Entry points keep returning a value, see findLightFunctions.
+     */
+    std::set<std::string> found;
+    for (const auto& entry : functions) {
+        const FunctionInfo& info = entry.second;
+        if (info.defined && !info.returnsValue && !info.resultUsed && info.numArgs >= 0 && entry.first != "Sys.init") {
+            found.insert(entry.first);
+        }
+    }
+    return found;
+}
+
+std::map<std::string, int> CallGraph::allocateProfileSlots(int top, int bottom, int words) const {
+    /**
+     * Gives every defined function a block of profile counters, in name order,
+     * ending just below top.
+     * @param bottom lowest address the counters may take
+     * @param words counter words per function
+     * @return function name -> address of its first counter
+     */
+    std::map<std::string, int> slots;
+    int count = 0;
+    for (const auto& entry : functions) {
+        if (entry.second.defined) count++;
+    }
+
+    int address = top - count * words;
+    if (address < bottom) {
+        throw std::runtime_error("--profile needs " + std::to_string(count * words) + " words for " + std::to_string(count) +
+                                 " functions, only RAM[" + std::to_string(bottom) + ".." + std::to_string(top - 1) + "] can be taken from the stack");
+    }
+    for (const auto& entry : functions) {
+        if (!entry.second.defined) continue;
+        slots[entry.first] = address;
+        address += words;
+    }
+    return slots;
+}
@@ -0,0 +1,477 @@
+#include "cfg.h"
+#include <set>
+#include <queue>
+
+ControlFlowGraph::ControlFlowGraph(const std::vector<VMCommand>& commands) {
+    build(commands);
+}
+
+void ControlFlowGraph::build(const std::vector<VMCommand>& commands) {
+    /**
+     * Splits the commands into basic blocks. A block starts at every label and
+     * after every goto, if-goto and return.
+     */
+    blocks.clear();
+    BasicBlock current{"", {}, false};
+
+    for (const auto& command : commands) {
+        if (command.type == CommandType::C_LABEL) {
+            if (!current.label.empty() || !current.body.empty()) blocks.push_back(current);
+            current = {command.arg1, {}, false};
+            continue;
+        }
+
+        current.body.push_back(command);
+        if (command.type == CommandType::C_GOTO || command.type == CommandType::C_IF ||
+            command.type == CommandType::C_RETURN) {
+            blocks.push_back(current);
+            current = {"", {}, false};
+        }
+    }
+    if (!current.label.empty() || !current.body.empty()) blocks.push_back(current);
+
+    index();
+}
+
+void ControlFlowGraph::index() {
+    labelBlock.clear();
+    for (size_t i = 0; i < blocks.size(); i++) {
+        if (!blocks[i].label.empty()) labelBlock[blocks[i].label] = i;
+    }
+}
+
+std::vector<size_t> ControlFlowGraph::successors(size_t block) const {
+    std::vector<size_t> result;
+    const BasicBlock& b = blocks[block];
+    CommandType last = b.body.empty() ? CommandType::C_UNKNOWN : b.body.back().type;
+
+    if (last == CommandType::C_GOTO || last == CommandType::C_IF) {
+        auto it = labelBlock.find(b.body.back().arg1);
+        if (it != labelBlock.end()) result.push_back(it->second);
+    }
+    if (last != CommandType::C_GOTO && last != CommandType::C_RETURN && block + 1 < blocks.size()) {
+        result.push_back(block + 1); //fall through
+    }
+    return result;
+}
+
+size_t ControlFlowGraph::nextNonEmpty(size_t block) const {
+    /**
+     * The block that actually runs when control reaches the given one,
+     * skipping over blocks that hold nothing but their label.
+     */
+    while (block < blocks.size() && blocks[block].body.empty()) block++;
+    return block;
+}
+
+std::string ControlFlowGraph::resolve(const std::string& label) const {
+    /**
+     * Follows a label through empty blocks and blocks that only hold a goto,
+     * to the label where real work starts.
+     */
+    std::set<std::string> visited;
+    std::string current = label;
+
+    while (visited.insert(current).second) {
+        auto it = labelBlock.find(current);
+        if (it == labelBlock.end()) break;
+
+        const BasicBlock& b = blocks[it->second];
+        if (b.body.empty()) {
+            size_t next = it->second + 1;
+            if (next >= blocks.size() || blocks[next].label.empty()) break;
+            current = blocks[next].label;
+        } else if (b.body.size() == 1 && b.body[0].type == CommandType::C_GOTO) {
+            current = b.body[0].arg1;
+        } else {
+            break;
+        }
+    }
+    return current;
+}
+
+bool ControlFlowGraph::isBooleanCondition(const std::vector<VMCommand>& body) const {
+    /**
+     * True if the value tested by the final if-goto is known to be 0 or -1, so
+     * it can be inverted with not. if-goto alone jumps on any non zero value.
+     */
+    auto isComparison = [](const VMCommand& c) {
+        return c.type == CommandType::C_ARITHMETIC && (c.arg1 == "eq" || c.arg1 == "gt" || c.arg1 == "lt");
+    };
+    size_t n = body.size();
+    if (n < 2) return false;
+    size_t i = n - 2;
+    while (i > 0 && body[i].type == CommandType::C_ARITHMETIC && body[i].arg1 == "not") i--; //not keeps it boolean
+    return isComparison(body[i]);
+}
+
+bool ControlFlowGraph::threadJumps() {
+    /**
+     * goto L where L only jumps on to M -> goto M, same for if-goto.
+     */
+    bool changed = false;
+    for (auto& b : blocks) {
+        if (b.body.empty()) continue;
+        VMCommand& last = b.body.back();
+        if (last.type != CommandType::C_GOTO && last.type != CommandType::C_IF) continue;
+
+        std::string target = resolve(last.arg1);
+        if (target != last.arg1) {
+            last.arg1 = target;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+bool ControlFlowGraph::foldConstantBranches() {
+    /**
+     * push constant 0, if-goto L       -> (nothing), never taken
+     * push constant c, if-goto L       -> goto L, c != 0
+     * push constant c, not, if-goto L  -> goto L, ~c is never 0
+     */
+    bool changed = false;
+    for (auto& b : blocks) {
+        size_t n = b.body.size();
+        if (n < 2 || b.body[n - 1].type != CommandType::C_IF) continue;
+
+        const VMCommand& previous = b.body[n - 2];
+        VMCommand jump{CommandType::C_GOTO, b.body[n - 1].arg1, -1};
+
+        if (previous.type == CommandType::C_PUSH && previous.arg1 == "constant") {
+            bool taken = previous.arg2 != 0;
+            b.body.resize(n - 2);
+            if (taken) b.body.push_back(jump);
+            changed = true;
+        } else if (n >= 3 && previous.type == CommandType::C_ARITHMETIC && previous.arg1 == "not" &&
+                   b.body[n - 3].type == CommandType::C_PUSH && b.body[n - 3].arg1 == "constant") {
+            b.body.resize(n - 3);
+            b.body.push_back(jump);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+bool ControlFlowGraph::invertBranches() {
+    /**
+     * if-goto A, goto B, label A  ->  [not] if-goto B, label A
+     * Only done when the condition is a comparison, where not is a true negation.
+     */
+    bool changed = false;
+    for (size_t i = 0; i + 2 < blocks.size(); i++) {
+        BasicBlock& b = blocks[i];
+        BasicBlock& jump = blocks[i + 1];
+        if (b.body.empty() || b.body.back().type != CommandType::C_IF || !isBooleanCondition(b.body)) continue;
+        if (!jump.label.empty() || jump.body.size() != 1 || jump.body[0].type != CommandType::C_GOTO) continue;
+
+        auto target = labelBlock.find(b.body.back().arg1);
+        if (target == labelBlock.end() || nextNonEmpty(target->second) != nextNonEmpty(i + 2)) continue;
+
+        size_t n = b.body.size();
+        VMCommand branch{CommandType::C_IF, jump.body[0].arg1, -1};
+        if (b.body[n - 2].type == CommandType::C_ARITHMETIC && b.body[n - 2].arg1 == "not") {
+            b.body.resize(n - 2); //drop the not
+        } else {
+            b.body.resize(n - 1);
+            b.body.push_back({CommandType::C_ARITHMETIC, "not", -1});
+        }
+        b.body.push_back(branch);
+        jump.body.clear();
+        changed = true;
+    }
+    return changed;
+}
+
+bool ControlFlowGraph::removeFallthroughGotos() {
+    /**
+     * goto L right before the code at L -> (nothing)
+     */
+    bool changed = false;
+    for (size_t i = 0; i + 1 < blocks.size(); i++) {
+        BasicBlock& b = blocks[i];
+        if (b.body.empty() || b.body.back().type != CommandType::C_GOTO) continue;
+
+        auto target = labelBlock.find(b.body.back().arg1);
+        if (target != labelBlock.end() && nextNonEmpty(target->second) == nextNonEmpty(i + 1)) {
+            b.body.pop_back();
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+bool ControlFlowGraph::removeUnreachable() {
+    /**
+     * Drops every block that cannot be reached from the entry block.
+     */
+    if (blocks.empty()) return false;
+
+    for (auto& b : blocks) b.reachable = false;
+    std::queue<size_t> work;
+    blocks[0].reachable = true;
+    work.push(0);
+    while (!work.empty()) {
+        size_t current = work.front();
+        work.pop();
+        for (size_t next : successors(current)) {
+            if (!blocks[next].reachable) {
+                blocks[next].reachable = true;
+                work.push(next);
+            }
+        }
+    }
+
+    std::vector<BasicBlock> kept;
+    for (const auto& b : blocks) {
+        if (b.reachable) kept.push_back(b);
+    }
+    bool changed = kept.size() != blocks.size();
+    blocks = kept;
+    index();
+    return changed;
+}
+
+bool ControlFlowGraph::removeUnusedLabels() {
+    /**
+     * Labels nothing jumps to only split blocks, so they are dropped.
+     */
+    std::set<std::string> targets;
+    for (const auto& b : blocks) {
+        for (const auto& command : b.body) {
+            if (command.type == CommandType::C_GOTO || command.type == CommandType::C_IF) targets.insert(command.arg1);
+        }
+    }
+
+    bool changed = false;
+    for (auto& b : blocks) {
+        if (!b.label.empty() && targets.count(b.label) == 0) {
+            b.label.clear();
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+bool ControlFlowGraph::simplify() {
+    /**
+     * Runs jump threading, constant branch folding, branch inversion and
+     * unreachable block removal until the graph stops changing.
+     * @return true if anything changed
+     */
+    bool any = false;
+    bool changed = true;
+    while (changed) {
+        changed = threadJumps();
+        changed |= foldConstantBranches();
+        changed |= invertBranches();
+        changed |= removeFallthroughGotos();
+        changed |= removeUnreachable();
+        changed |= removeUnusedLabels();
+        if (changed) {
+            build(commands()); //merge blocks that lost their label or terminator
+            any = true;
+        }
+    }
+    return any;
+}
+
+//block layout
+
+long ControlFlowGraph::count(const std::string& label) const {
+    /**
+     * Profile count of a label of this function, -1 if the profile has none.
+     */
+    auto it = profile.find(functionName + "$" + label);
+    return it == profile.end() ? -1 : it->second;
+}
+
+std::string ControlFlowGraph::uniqueLabel(const std::string& base) const {
+    std::string label = base;
+    for (int i = 1; labelBlock.count(label); i++) {
+        label = base + "_" + std::to_string(i);
+    }
+    return label;
+}
+
+void ControlFlowGraph::invertCondition(std::vector<VMCommand>& body, const std::string& target) const {
+    /**
+     * Replaces the final if-goto of body with one that jumps to target exactly
+     * when the original did not jump. Boolean conditions toggle a not, any
+     * other value is compared with 0.
+     */
+    bool boolean = isBooleanCondition(body);
+    body.pop_back();
+
+    if (boolean) {
+        if (body.back().type == CommandType::C_ARITHMETIC && body.back().arg1 == "not") {
+            body.pop_back();
+        } else {
+            body.push_back({CommandType::C_ARITHMETIC, "not", -1});
+        }
+    } else {
+        body.push_back({CommandType::C_PUSH, "constant", 0});
+        body.push_back({CommandType::C_ARITHMETIC, "eq", -1});
+    }
+    body.push_back({CommandType::C_IF, target, -1});
+}
+
+bool ControlFlowGraph::canFallThrough(size_t block) const {
+    const BasicBlock& b = blocks[block];
+    if (b.body.empty()) return true;
+    return b.body.back().type != CommandType::C_GOTO && b.body.back().type != CommandType::C_RETURN;
+}
+
+bool ControlFlowGraph::rotateLoop(size_t header) {
+    /**
+     * Moves a loop test from the top of the loop to the bottom:
+     *
+     * label H, test, if-goto X, body, goto H, label X
+     * -> goto H, label B, body, label H, inverted test, if-goto B, label X
+     *
+     * The loop then runs without a taken goto per iteration, entering it costs
+     * one. With a profile, only loops that iterate more often than they are
+     * entered are rotated.
+     * @return true if the loop was rotated
+     */
+    const BasicBlock& h = blocks[header];
+    if (h.label.empty() || h.body.empty() || h.body.back().type != CommandType::C_IF) return false;
+    if (!isBooleanCondition(h.body)) return false; //comparing with 0 would cost more than the goto
+
+    auto exit = labelBlock.find(h.body.back().arg1);
+    if (exit == labelBlock.end() || exit->second <= header + 1) return false;
+
+    //the back edge: the last block before the exit jumps to the header
+    size_t back = exit->second - 1;
+    while (back > header && blocks[back].body.empty() && blocks[back].label.empty()) back--;
+    if (back <= header || blocks[back].body.empty()) return false;
+    const VMCommand& last = blocks[back].body.back();
+    if (last.type != CommandType::C_GOTO || last.arg1 != h.label) return false;
+
+    long exits = count(h.body.back().arg1); //every entry leaves through X once
+    long tests = count(h.label);
+    if (exits >= 0 && tests >= 0 && tests <= 2 * exits) return false;
+
+    std::string bodyLabel = blocks[header + 1].label.empty() ? uniqueLabel(h.label + "_BODY") : blocks[header + 1].label;
+
+    BasicBlock test = h;
+    invertCondition(test.body, bodyLabel);
+
+    std::vector<BasicBlock> rotated(blocks.begin(), blocks.begin() + header);
+    if (header == 0 || canFallThrough(header - 1)) { //the code before the loop, or its start, enters at the test
+        rotated.push_back({"", {{CommandType::C_GOTO, h.label, -1}}, false});
+    }
+    size_t bodyStart = rotated.size();
+    rotated.insert(rotated.end(), blocks.begin() + header + 1, blocks.begin() + back + 1);
+    rotated[bodyStart].label = bodyLabel;
+    rotated.back().body.pop_back(); //the goto H, the test follows now
+    rotated.push_back(test);
+    rotated.insert(rotated.end(), blocks.begin() + back + 1, blocks.end());
+
+    blocks = rotated;
+    index();
+    return true;
+}
+
+bool ControlFlowGraph::swapArms(size_t branch) {
+    /**
+     * Puts the hotter arm of an if/else right after the test, using the profile:
+     *
+     * test, if-goto F, then, goto E, label F, else, label E
+     * -> inverted test, if-goto T, label F, else, goto E, label T, then, label E
+     *
+     * The else arm is hotter when F is reached more often than the then arm,
+     * which is E minus F.
+     * @return true if the arms were swapped
+     */
+    const BasicBlock& b = blocks[branch];
+    if (b.body.empty() || b.body.back().type != CommandType::C_IF) return false;
+
+    auto elseStart = labelBlock.find(b.body.back().arg1);
+    if (elseStart == labelBlock.end() || elseStart->second <= branch + 1) return false;
+    size_t thenEnd = elseStart->second - 1;
+    if (blocks[thenEnd].body.empty() || blocks[thenEnd].body.back().type != CommandType::C_GOTO) return false;
+
+    auto end = labelBlock.find(blocks[thenEnd].body.back().arg1);
+    if (end == labelBlock.end() || end->second <= elseStart->second) return false;
+
+    long elseCount = count(blocks[elseStart->second].label);
+    long endCount = count(blocks[end->second].label);
+    if (elseCount < 0 || endCount < 0 || elseCount <= endCount - elseCount) return false;
+
+    std::string thenLabel = blocks[branch + 1].label.empty() ? uniqueLabel(b.body.back().arg1 + "_THEN") : blocks[branch + 1].label;
+
+    BasicBlock test = b;
+    invertCondition(test.body, thenLabel);
+
+    std::vector<BasicBlock> swapped(blocks.begin(), blocks.begin() + branch);
+    swapped.push_back(test);
+    swapped.insert(swapped.end(), blocks.begin() + elseStart->second, blocks.begin() + end->second);
+    if (canFallThrough(end->second - 1)) {
+        swapped.push_back({"", {{CommandType::C_GOTO, blocks[end->second].label, -1}}, false});
+    }
+    size_t thenStart = swapped.size();
+    swapped.insert(swapped.end(), blocks.begin() + branch + 1, blocks.begin() + thenEnd + 1);
+    swapped[thenStart].label = thenLabel;
+    swapped.back().body.pop_back(); //the goto E, E follows now
+    swapped.insert(swapped.end(), blocks.begin() + end->second, blocks.end());
+
+    blocks = swapped;
+    index();
+    return true;
+}
+
+int ControlFlowGraph::layout(const std::map<std::string, long>& labelCounts) {
+    /**
+     * Reorders the blocks so the likely successor falls through: loops get their
+     * test at the bottom and, when a profile is given, the hotter arm of an
+     * if/else comes first. Meant to run after simplify, which would undo parts of it.
+     * @param labelCounts profile counts by Function$label, may be empty
+     * @return the number of loops rotated plus arms swapped
+     */
+    profile = labelCounts;
+    functionName = "";
+    if (!blocks.empty() && !blocks[0].body.empty() && blocks[0].body[0].type == CommandType::C_FUNCTION) {
+        functionName = blocks[0].body[0].arg1;
+    }
+
+    //a moved test jumps backwards (loops) or to the colder arm, so it does not
+    //match again, the limit only guards against an inconsistent profile
+    int changes = 0;
+    int limit = static_cast<int>(blocks.size());
+    bool changed = true;
+    while (changed && changes < limit) {
+        changed = false;
+        for (size_t i = 0; i < blocks.size() && !changed; i++) {
+            changed = rotateLoop(i) || swapArms(i); //indices moved, start over
+        }
+        if (changed) changes++;
+    }
+    return changes;
+}
+
+size_t ControlFlowGraph::blockCount() const {
+    return blocks.size();
+}
+
+std::vector<VMCommand> ControlFlowGraph::commands() const {
+    std::vector<VMCommand> result;
+    for (const auto& b : blocks) {
+        if (!b.label.empty()) result.push_back({CommandType::C_LABEL, b.label, -1});
+        result.insert(result.end(), b.body.begin(), b.body.end());
+    }
+    return result;
+}
+
+std::vector<std::vector<VMCommand>> ControlFlowGraph::splitFunctions(const std::vector<VMCommand>& commands) {
+    /**
+     * Splits a file into one command list per function. Commands before the
+     * first function command form a list of their own.
+     */
+    std::vector<std::vector<VMCommand>> functions;
+    for (const auto& command : commands) {
+        if (command.type == CommandType::C_FUNCTION || functions.empty()) functions.emplace_back();
+        functions.back().push_back(command);
+    }
+    return functions;
+}
@@ -1,13 +1,22 @@
 #include "codewriter.h"
+#include "nativeos.h"
 #include <stdexcept>
 #include <iostream>
+#include <cstdlib>
 
-CodeWriter::CodeWriter(const std::string& outputFileName) 
-    : labelCounter(0), callCounter(0), currentFunction("") {
-    outputFile.open(outputFileName);
-    if (!outputFile.is_open()) {
+CodeWriter::CodeWriter(const std::string& outputFileName) : CodeWriter(nullptr) {
+    file.open(outputFileName);
+    if (!file.is_open()) {
         throw std::runtime_error("Could not open output file: " + outputFileName);
     }
+    outputFile.rdbuf(file.rdbuf());
+}
+
+CodeWriter::CodeWriter(std::streambuf* output)
+    : outputFile(output), currentFunction(""), labelCounter(0), callCounter(0), cacheTop(false), topInD(false), registerCount(0), batchSP(false), spOffset(0), currentFrame(nullptr), currentLight(false), tailCallUsed(false), multiplyUsed(false), divideUsed(false), profileClock(-1), sourceMap(false), fileLabels(false), nativeOS(false) {
+    /**
+     * Writes to a stream the caller owns, ex. std::cout.rdbuf().
+     */
 }
 
 CodeWriter::~CodeWriter() {
@@ -15,6 +24,11 @@ CodeWriter::~CodeWriter() {
 }
 
 void CodeWriter::setFileName(const std::string& fileName) {
+    spillTop(); //file boundary, leave the stack in RAM
+    if (fileLabels) { //labels restart for every file, they carry its name
+        labelCounter = 0;
+        callCounter = 0;
+    }
     size_t lastSlash = fileName.find_last_of("/\\");
     size_t lastDot = fileName.find_last_of('.');
 
@@ -33,8 +47,168 @@ void CodeWriter::setFileName(const std::string& fileName) {
     }
 }
 
+void CodeWriter::setCacheTop(bool enabled) {
+    /**
+     * Enables or disables top of stack caching. When enabled, the value on top
+     * of the stack is kept in D between commands and only written back to RAM
+     * at labels, jumps, calls, returns, function entries and file boundaries.
+     * @param enabled true to keep the top of stack in D
+     */
+    spillTop();
+    cacheTop = enabled;
+}
+
+void CodeWriter::setBatchSP(bool enabled) {
+    /**
+     * Enables batched stack pointer updates: pushes and pops in straight line
+     * code address their slots relative to RAM[SP] and SP is written back once,
+     * before anything that needs it in RAM. Has no effect together with
+     * top of stack caching, which already avoids most SP traffic.
+     * @param enabled true to batch SP updates
+     */
+    batchSP = enabled;
+}
+
+void CodeWriter::setStaticFrames(const std::map<std::string, StaticFrame>& frames) {
+    /**
+     * Sets the functions that get a fixed frame instead of a stack frame,
+     * see CallGraph::allocateStaticFrames. Their local and argument slots are
+     * addressed directly and calls to them use writeStaticCall.
+     * @param frames function name -> frame
+     */
+    staticFrames = frames;
+    currentFrame = nullptr;
+}
+
+void CodeWriter::setLightFunctions(const std::set<std::string>& functions) {
+    /**
+     * Sets the functions that never change THIS/THAT, see CallGraph::findLightFunctions.
+     * They get a 3 word frame (return address, LCL, ARG) instead of 5.
+     * @param functions names of the light functions
+     */
+    lightFunctions = functions;
+}
+
+void CodeWriter::setProfile(const std::map<std::string, int>& slots, int clock) {
+    /**
+     * Enables profiling, see CallGraph::allocateProfileSlots. Every function
+     * entry adds one to a 32 bit call counter: RAM[slot] is the low word and
+     * RAM[slot+1] the high word. With a clock, RAM[slot+2] accumulates the
+     * clock difference between entry and exit (inclusive, 16 bit).
+     * @param slots function name -> address of its counters
+     * @param clock address of a clock register, -1 to count calls only
+     */
+    profileSlots = slots;
+    profileClock = clock;
+}
+
+void CodeWriter::setSourceMap(bool enabled) {
+    /**
+     * Enables source markers: a "//@ Main.vm:12 Main.jack:4 push local 0" comment
+     * before the code of every command, see writeMarker. The assembler turns
+     * them into a map from ROM address to VM command and Jack line.
+     * @param enabled true to write the markers
+     */
+    sourceMap = enabled;
+}
+
+void CodeWriter::writeMarker(const std::string& text) {
+    /**
+     * Writes a source marker if they are enabled. Everything up to the next
+     * marker is attributed to it, including code held back by top of stack
+     * caching or batched SP updates.
+     * @param text where the code comes from, "- - what" for generated code
+     */
+    if (sourceMap) {
+        outputFile << "//@ " << text << "\n";
+    }
+}
+
+void CodeWriter::setFileLabels(bool enabled) {
+    /**
+     * Makes the code of every file independent of the files before it:
+     * generated labels are named File:TRUE_1 and numbered per file, so the
+     * code of one file can be cached and spliced into a later translation,
+     * see TranslationCache.
+     * @param enabled true to name generated labels after the file
+     */
+    fileLabels = enabled;
+}
+
+void CodeWriter::setNativeOS(bool enabled) {
+    /**
+     * Calls to the OS functions in nativeRoutines, Math.multiply and Math.divide
+     * run hand written assembly instead of the compiled function, without a frame.
+     * @param enabled true to link the native versions
+     */
+    nativeOS = enabled;
+}
+
+void CodeWriter::setVoidFunctions(const std::set<std::string>& functions) {
+    /**
+     * Functions whose value is never used, see CallGraph::findVoidFunctions.
+     * Their returns leave nothing on the stack and calls to them are written
+     * with writeVoidCall, which has no pop temp 0.
+     */
+    voidFunctions = functions;
+}
+
+bool CodeWriter::hasNative(const std::string& functionName, int numArgs) const {
+    /**
+     * @return true if calls to the function are written as native code, see writeNativeCall
+     */
+    if (!nativeOS) return false;
+    if ((functionName == "Math.multiply" || functionName == "Math.divide") && numArgs == 2) return true;
+    auto it = nativeRoutines().find(functionName);
+    return it != nativeRoutines().end() && it->second.numArgs == numArgs;
+}
+
+void CodeWriter::countInstructions() {
+    /**
+     * Starts counting the instructions written, for the --report cost model.
+     */
+    counter = std::make_unique<InstructionCounter>(outputFile.rdbuf());
+    outputFile.rdbuf(counter.get());
+}
+
+long CodeWriter::instructionCount() const {
+    return counter ? counter->instructions() : 0;
+}
+
+std::string CodeWriter::labelPrefix() {
+    return fileLabels && !currentFileName.empty() ? currentFileName + ":" : "";
+}
+
+std::streampos CodeWriter::filePosition() {
+    /**
+     * Writes out anything held back for the current file and returns the
+     * output position, to cut the code of one file out of the output.
+     */
+    spillTop();
+    outputFile.flush();
+    return outputFile.tellp();
+}
+
+void CodeWriter::writeCached(const std::string& code) {
+    /**
+     * Splices in the code of a file from an earlier translation, written with
+     * file labels. Shared routines it jumps to are emitted on close as usual.
+     * @param code the cached assembly of the whole file
+     */
+    spillTop();
+    outputFile << code;
+    tailCallUsed = tailCallUsed || code.find("@TAIL_CALL\n") != std::string::npos;
+    multiplyUsed = multiplyUsed || code.find("@MATH_MULTIPLY\n") != std::string::npos;
+    divideUsed = divideUsed || code.find("@MATH_DIVIDE\n") != std::string::npos;
+    for (const auto& routine : nativeRoutines()) {
+        if (routine.second.shared && code.find("@NATIVE_" + routine.first + "\n") != std::string::npos) {
+            nativeUsed.insert(routine.first);
+        }
+    }
+}
+
 std::string CodeWriter::generateLabel(const std::string& prefix) { //generate unique label ex. TRUE_1, END_2
-    return prefix + "_" + std::to_string(++labelCounter);
+    return labelPrefix() + prefix + "_" + std::to_string(++labelCounter);
 }
 
 void CodeWriter::writeArithmetic(const std::string& command) {
@@ -43,6 +217,15 @@ void CodeWriter::writeArithmetic(const std::string& command) {
      * Valid commands are: add, sub, neg, eq, gt, lt, and, or, not
      * @param command the arithmetic command to translate
      */
+    if (cacheTop) {
+        writeCachedArithmetic(command);
+        return;
+    }
+    if (batchSP) {
+        writeBatchedArithmetic(command);
+        return;
+    }
+
     outputFile << "//" << command << std::endl;
 
     if (command == "add") {
@@ -130,6 +313,45 @@ void CodeWriter::writePushPop(const std::string& command, const std::string& seg
      * @param segment the memory segment to operate on
      * @param index the index within the segment
      */
+    if (batchSP && !cacheTop) {
+        if (command == "push") {
+            writeBatchedPush(segment, index);
+        } else {
+            writeBatchedPop(segment, index);
+        }
+        return;
+    }
+    if (cacheTop) {
+        if (command == "push") {
+            writeCachedPush(segment, index);
+        } else if (command == "pop") {
+            writeCachedPop(segment, index);
+        }
+        return;
+    }
+
+    int slot = staticSlot(segment, index);
+    if (slot >= 0) { //local or argument of a function with a static frame
+        outputFile << "// " << command << " " << segment << " " << index << std::endl;
+        if (command == "push") {
+            outputFile << "@" << slot << "\n"
+                       << "D=M\n"
+                       << "@SP\n"
+                       << "A=M\n"
+                       << "M=D\n"
+                       << "@SP\n"
+                       << "M=M+1\n";
+        } else {
+            outputFile << "@SP\n"
+                       << "AM=M-1\n"
+                       << "D=M\n"
+                       << "@" << slot << "\n"
+                       << "M=D\n";
+        }
+        outputFile << std::endl;
+        return;
+    }
+
     if (command == "push") {
         outputFile << "// push " << segment << " " << index << std::endl;
 
@@ -259,169 +481,1142 @@ void CodeWriter::writePopSegment(const std::string& segment, int index) {
                << "M=D\n";
 }
 
-//chapter 8 methods
+//top of stack caching
 
-void CodeWriter::writeInit() {
+void CodeWriter::spillTop() {
     /**
-     * Writes the assembly code that effects the VM initialization,
-     * also called bootstrap code. This code must be placed at the
-     * beginning of the output file.
+     * Writes the cached top of stack from D back to RAM, so the stack is
+     * exactly as the VM specification describes it. Does nothing if the
+     * top of stack is already in RAM. Also writes back a batched SP and the
+     * values held in R13-R15, the top goes above them.
      */
-    outputFile << "// Bootstrap code\n"
-               << "@256\n"
-               << "D=A\n"
+    flushSP();
+    if (!topInD) return;
+
+    if (registerCount > 0) {
+        writeStackAddress(registerCount); //no SP offset here, A = SP + registerCount
+        outputFile << "M=D\n";
+        for (int i = 0; i < registerCount; i++) {
+            outputFile << "@R" << (13 + i) << "\n"
+                       << "D=M\n";
+            writeStackAddress(i);
+            outputFile << "M=D\n";
+        }
+        outputFile << "@" << (registerCount + 1) << "\n"
+                   << "D=A\n"
+                   << "@SP\n"
+                   << "M=D+M\n";
+        registerCount = 0;
+        topInD = false;
+        return;
+    }
+
+    outputFile << "@SP\n"
+               << "A=M\n"
+               << "M=D\n"
                << "@SP\n"
-               << "M=D\n";
-    
-    writeCall("Sys.init", 0); //call Sys.init with 0 args
+               << "M=M+1\n";
+    topInD = false;
 }
 
-void CodeWriter::writeLabel(const std::string& label) {
+void CodeWriter::loadTop() {
     /**
-     * Writes the assembly code that is the translation of the given label command.
-     * The label is function-scoped and uses the format functionName$label.
-     * Example: (SimpleFunction$LOOP)
-     * @param label the label to declare
+     * Makes sure the top of stack is held in D, popping it from RAM if needed.
      */
-    outputFile << "// label " << label << std::endl;
-    outputFile << "(" << currentFunction << "$" << label << ")\n"; //functionName$label ex. SimpleFunction$LOOP
-    outputFile << std::endl;
+    if (topInD) return;
+
+    outputFile << "@SP\n"
+               << "AM=M-1\n"
+               << "D=M\n";
+    topInD = true;
 }
 
-void CodeWriter::writeGoto(const std::string& label) {
+void CodeWriter::flushRegisters() {
     /**
-     * Writes the assembly code that is the translation of the given goto command.
-     * Unconditional jump to a function-scoped label using the format functionName$label.
-     * Example: @SimpleFunction$LOOP 0;JMP
-     * @param label the label to go to
+     * Before code that needs the values below the top in RAM or uses R13-R15,
+     * spills the stack if any of them are held in registers.
      */
-    outputFile << "// goto " << label << std::endl;
-    outputFile << "@" << currentFunction << "$" << label << "\n" //functionName$label
-               << "0;JMP\n";
-    outputFile << std::endl;
+    if (registerCount > 0) spillTop();
 }
 
-void CodeWriter::writeIf(const std::string& label) {
+void CodeWriter::writeCachedArithmetic(const std::string& command) {
     /**
-     * Writes the assembly code that is the translation of the given if-goto command.
-     * Conditional jump to a function-scoped label using the format functionName$label.
-     * Example: @SimpleFunction$LOOP D;JNE
-     * @param label the label to go to if top stack value != 0
+     * Arithmetic with the top of stack cached in D. Binary commands take y from D
+     * and x from RAM[SP-1], and leave the result in D.
+     * @param command the arithmetic command to translate
      */
-    outputFile << "// if-goto " << label << std::endl;
-    outputFile << "@SP\n"
-               << "AM=M-1\n"
-               << "D=M\n"
-               << "@" << currentFunction << "$" << label << "\n" //functionName$label
-               << "D;JNE\n";
+    outputFile << "//" << command << std::endl;
+
+    if (command == "neg" || command == "not") {
+        if (topInD) {
+            outputFile << (command == "neg" ? "D=-D\n" : "D=!D\n");
+        } else { //operate in place, no need to bring it into D
+            outputFile << "@SP\n"
+                       << "A=M-1\n"
+                       << (command == "neg" ? "M=-M\n" : "M=!M\n");
+        }
+        outputFile << std::endl;
+        return;
+    }
+
+    loadTop(); //y
+    if (registerCount > 0) {
+        outputFile << "@R" << (12 + registerCount) << "\n"; //A = register holding x
+        registerCount--;
+    } else {
+        outputFile << "@SP\n"
+                   << "AM=M-1\n"; //A = address of x
+    }
+
+    if (command == "add") {
+        outputFile << "D=D+M\n";
+    } else if (command == "sub") {
+        outputFile << "D=M-D\n";
+    } else if (command == "and") {
+        outputFile << "D=D&M\n";
+    } else if (command == "or") {
+        outputFile << "D=D|M\n";
+    } else if (command == "eq" || command == "gt" || command == "lt") {
+        std::string labelTrue = generateLabel("TRUE");
+        std::string labelEnd = generateLabel("END");
+        std::string jumpType = command == "eq" ? "JEQ" : (command == "gt" ? "JGT" : "JLT");
+
+        outputFile << "D=M-D\n"
+                   << "@" << labelTrue << "\n"
+                   << "D;" << jumpType << "\n"
+                   << "D=0\n"
+                   << "@" << labelEnd << "\n"
+                   << "0;JMP\n"
+                   << "(" << labelTrue << ")\n"
+                   << "D=-1\n"
+                   << "(" << labelEnd << ")\n";
+    } else {
+        throw std::runtime_error("Unknown arithmetic command: " + command);
+    }
+
     outputFile << std::endl;
 }
 
-void CodeWriter::writeCall(const std::string& functionName, int numArgs) {
+void CodeWriter::writeCachedPush(const std::string& segment, int index) {
     /**
-     * Writes the assembly code that is the translation of the given call command.
-     * 
-     * process: 
-     * push return-address; //unique label for return address
-     * push LCL; //save LCL of caller for later restoration
-     * push ARG; //save ARG of caller for later restoration
-     * push THIS; //save THIS of caller for later restoration
-     * push THAT; //save THAT of caller for later restoration
-     * ARG = SP-n-5; //reposition ARG for callee
-     * LCL = SP;  //reposition LCL for callee
-     * goto functionName; (return-address) //transfer control to callee
-     * 
-     * @param functionName the name of the function to call ex. Sys.init
-     * @param numArgs the number of arguments to pass to the function
+     * Push with the top of stack cached in D. The previous top is spilled and
+     * the pushed value becomes the new cached top.
+     * @param segment the memory segment to push from
+     * @param index the index within the segment
      */
-    std::string returnLabel = "RETURN_" + std::to_string(++callCounter); //unique return label
-    
-    outputFile << "// call " << functionName << " " << numArgs << std::endl;
-    
-    // Push return address to stack
-    outputFile << "@" << returnLabel << "\n"
-               << "D=A\n"
-               << "@SP\n"
-               << "A=M\n"
-               << "M=D\n"
-               << "@SP\n"
-               << "M=M+1\n";
-    
-    // Push LCL to save caller's LCL for later restoration
-    outputFile << "@LCL\n"
-               << "D=M\n"
-               << "@SP\n"
-               << "A=M\n"
-               << "M=D\n"
-               << "@SP\n"
-               << "M=M+1\n";
-    
-    // Push ARG
-    outputFile << "@ARG\n"
-               << "D=M\n"
-               << "@SP\n"
-               << "A=M\n"
-               << "M=D\n"
-               << "@SP\n"
-               << "M=M+1\n";
-    
-    // Push THIS
-    outputFile << "@THIS\n"
-               << "D=M\n"
-               << "@SP\n"
-               << "A=M\n"
-               << "M=D\n"
-               << "@SP\n"
-               << "M=M+1\n";
-    
-    // Push THAT
-    outputFile << "@THAT\n"
-               << "D=M\n"
-               << "@SP\n"
-               << "A=M\n"
-               << "M=D\n"
-               << "@SP\n"
-               << "M=M+1\n";
-    
-    // ARG = SP - n - 5
-    outputFile << "@SP\n" //get current SP
-               << "D=M\n" //D = SP
-               << "@" << (numArgs + 5) << "\n" // subtract (numArgs + 5) from SP: SP - numArgs - 5
-               << "D=D-A\n" // D = SP - numArgs - 5
-               << "@ARG\n" //set ARG 
-               << "M=D\n"; //ARG = SP - n - 5 ARG now points to base of args for callee
-    
-    // LCL = SP
-    outputFile << "@SP\n" //reposition LCL for callee
-               << "D=M\n" //D = SP
-               << "@LCL\n" //set LCL
-               << "M=D\n"; //LCL = SP
-    
-    // goto functionName
-    outputFile << "@" << functionName << "\n"
-               << "0;JMP\n";
-    
-    // (return address)
-    outputFile << "(" << returnLabel << ")\n";
+    outputFile << "// push " << segment << " " << index << std::endl;
+    spillTop();
+    writeLoadD(segment, index);
+    topInD = true;
     outputFile << std::endl;
 }
 
-void CodeWriter::writeReturn() {
+void CodeWriter::writeCachedPop(const std::string& segment, int index) {
     /**
-     * Writes the assembly code that is the translation of the given return command.
-     * 
-     * process:
-     * FRAME = LCL; //FRAME is a temporary variable
-     * RET = *(FRAME-5); //get return address
-     * *ARG = pop(); //reposition return value for caller
-     * SP = ARG + 1; //restore SP of caller
-     * THAT = *(FRAME-1); //restore THAT of caller
-     * THIS = *(FRAME-2); //restore THIS of caller
-     * ARG = *(FRAME-3); //restore ARG of caller
-     * LCL = *(FRAME-4); //restore LCL of caller
-     * goto RET; //goto return address
+     * Pop with the top of stack cached in D. The value is stored straight from D,
+     * afterwards the new top of stack is in RAM, or in D if it was in a register.
+     * @param segment the memory segment to pop into
+     * @param index the index within the segment
      */
-    outputFile << "// return\n";
+    outputFile << "// pop " << segment << " " << index << std::endl;
+    if (!isDirectSlot(segment, index)) flushRegisters(); //the store goes through R13 and R14
+    loadTop();
+    writeStoreD(segment, index);
+    if (registerCount > 0) { //the value below becomes the top
+        outputFile << "@R" << (12 + registerCount) << "\n"
+                   << "D=M\n";
+        registerCount--;
+    } else {
+        topInD = false;
+    }
+    outputFile << std::endl;
+}
+
+//batched stack pointer
+
+void CodeWriter::flushSP() {
+    /**
+     * Writes the pending SP offset back to RAM[SP]. Uses M=M+1 / M=M-1 steps
+     * so D survives, the offset never gets beyond 2 either way.
+     */
+    for (; spOffset > 0; spOffset--) {
+        outputFile << "@SP\n"
+                   << "M=M+1\n";
+    }
+    for (; spOffset < 0; spOffset++) {
+        outputFile << "@SP\n"
+                   << "M=M-1\n";
+    }
+}
+
+void CodeWriter::writeStackAddress(int offset) {
+    /**
+     * A = logical SP + offset, without touching D. Offsets within 2 of RAM[SP]
+     * are reached directly, callers flush before going further.
+     * @param offset slot relative to the logical SP, -1 is the top of stack
+     */
+    int slot = spOffset + offset;
+    outputFile << "@SP\n";
+    if (slot == 0) {
+        outputFile << "A=M\n";
+    } else {
+        outputFile << (slot > 0 ? "A=M+1\n" : "A=M-1\n");
+        for (int i = 1; i < std::abs(slot); i++) {
+            outputFile << (slot > 0 ? "A=A+1\n" : "A=A-1\n");
+        }
+    }
+}
+
+void CodeWriter::writeBatchedPush(const std::string& segment, int index) {
+    /**
+     * push with batched SP: D = value, RAM[SP + offset] = D, offset++.
+     */
+    outputFile << "// push " << segment << " " << index << std::endl;
+    if (spOffset >= 2) flushSP();
+    writeLoadD(segment, index);
+    writeStackAddress(0);
+    outputFile << "M=D\n";
+    spOffset++;
+    outputFile << std::endl;
+}
+
+void CodeWriter::writeBatchedPop(const std::string& segment, int index) {
+    /**
+     * pop with batched SP: offset--, D = RAM[SP + offset], segment[index] = D.
+     */
+    outputFile << "// pop " << segment << " " << index << std::endl;
+    if (spOffset <= -2) flushSP();
+    writeStackAddress(-1);
+    outputFile << "D=M\n";
+    spOffset--;
+    writeStoreD(segment, index);
+    outputFile << std::endl;
+}
+
+void CodeWriter::writeBatchedArithmetic(const std::string& command) {
+    /**
+     * Arithmetic with batched SP, the operands are addressed relative to RAM[SP].
+     * @param command the arithmetic command to translate
+     */
+    outputFile << "//" << command << std::endl;
+    if (spOffset <= -1) flushSP(); //x is at offset -2
+
+    if (command == "neg" || command == "not") {
+        writeStackAddress(-1);
+        outputFile << (command == "neg" ? "M=-M\n" : "M=!M\n");
+        outputFile << std::endl;
+        return;
+    }
+
+    writeStackAddress(-1);
+    outputFile << "D=M\n"
+               << "A=A-1\n";
+    spOffset--;
+
+    if (command == "add") {
+        outputFile << "M=D+M\n";
+    } else if (command == "sub") {
+        outputFile << "M=M-D\n";
+    } else if (command == "and") {
+        outputFile << "M=D&M\n";
+    } else if (command == "or") {
+        outputFile << "M=D|M\n";
+    } else if (command == "eq" || command == "gt" || command == "lt") {
+        std::string labelTrue = generateLabel("TRUE");
+        outputFile << "D=M-D\n"
+                   << "M=-1\n"
+                   << "@" << labelTrue << "\n"
+                   << "D;" << jumpFor(command, false) << "\n";
+        writeStackAddress(-1);
+        outputFile << "M=0\n"
+                   << "(" << labelTrue << ")\n";
+    } else {
+        throw std::runtime_error("Unknown arithmetic command: " + command);
+    }
+    outputFile << std::endl;
+}
+
+//segment addressing helpers shared by the cached and fused code paths
+
+std::string CodeWriter::segmentBase(const std::string& segment) {
+    /**
+     * Returns the base pointer of a pointer based segment, or "" for the others.
+     * @param segment the VM segment name ex. local
+     */
+    if (segment == "local") return "LCL";
+    if (segment == "argument") return "ARG";
+    if (segment == "this") return "THIS";
+    if (segment == "that") return "THAT";
+    return "";
+}
+
+int CodeWriter::staticSlot(const std::string& segment, int index) {
+    /**
+     * Returns the fixed address of a local or argument slot when the current
+     * function has a static frame, -1 otherwise.
+     */
+    if (currentFrame == nullptr) return -1;
+    if (segment == "local") return currentFrame->local(index);
+    if (segment == "argument") return currentFrame->argument(index);
+    return -1;
+}
+
+bool CodeWriter::isDirectSlot(const std::string& segment, int index) {
+    /**
+     * True if the slot can be addressed into A without touching D.
+     * Pointer based slots qualify while the index is small enough to walk.
+     */
+    if (segment == "temp" || segment == "static" || segment == "pointer") return true;
+    if (staticSlot(segment, index) >= 0) return true;
+    return !segmentBase(segment).empty() && index <= 6;
+}
+
+void CodeWriter::writeAddress(const std::string& segment, int index, bool keepD) {
+    /**
+     * Leaves the RAM address of segment[index] in A.
+     * @param segment the memory segment (not constant)
+     * @param index the index within the segment
+     * @param keepD true if D holds a live value, pointer based slots are then
+     *              reached by walking A (see isDirectSlot)
+     */
+    std::string base = segmentBase(segment);
+    int slot = staticSlot(segment, index);
+
+    if (slot >= 0) {
+        outputFile << "@" << slot << "\n";
+    } else if (!base.empty()) {
+        if (index <= 2 || (keepD && index <= 6)) { //walk A up to the slot
+            outputFile << "@" << base << "\n";
+            if (index == 0) {
+                outputFile << "A=M\n";
+            } else {
+                outputFile << "A=M+1\n";
+                for (int i = 1; i < index; i++) {
+                    outputFile << "A=A+1\n";
+                }
+            }
+        } else {
+            outputFile << "@" << base << "\n"
+                       << "D=M\n"
+                       << "@" << index << "\n"
+                       << "A=D+A\n";
+        }
+    } else if (segment == "temp") {
+        outputFile << "@" << (5 + index) << "\n";
+    } else if (segment == "static") {
+        outputFile << "@" << currentFileName << "." << index << "\n";
+    } else if (segment == "pointer") {
+        outputFile << (index == 0 ? "@THIS\n" : "@THAT\n");
+    } else {
+        throw std::runtime_error("Unknown segment: " + segment);
+    }
+}
+
+void CodeWriter::writeLoadD(const std::string& segment, int index) {
+    /**
+     * D = segment[index]
+     */
+    if (segment == "constant") {
+        outputFile << "@" << index << "\n"
+                   << "D=A\n";
+        return;
+    }
+    writeAddress(segment, index, false);
+    outputFile << "D=M\n";
+}
+
+void CodeWriter::writeStoreD(const std::string& segment, int index) {
+    /**
+     * segment[index] = D
+     */
+    if (isDirectSlot(segment, index)) {
+        writeAddress(segment, index, true);
+        outputFile << "M=D\n";
+        return;
+    }
+
+    std::string base = segmentBase(segment);
+    if (base.empty()) {
+        throw std::runtime_error("Unknown segment for pop: " + segment);
+    }
+    outputFile << "@R13\n"
+               << "M=D\n" //R13 = value
+               << "@" << base << "\n"
+               << "D=M\n"
+               << "@" << index << "\n"
+               << "D=D+A\n"
+               << "@R14\n"
+               << "M=D\n" //R14 = address
+               << "@R13\n"
+               << "D=M\n"
+               << "@R14\n"
+               << "A=M\n"
+               << "M=D\n";
+}
+
+//fused command sequences
+
+std::string CodeWriter::jumpFor(const std::string& command, bool negate) {
+    /**
+     * Maps a comparison to the Hack jump that is taken when it holds,
+     * or when it fails if negate is set.
+     */
+    if (command == "eq") return negate ? "JNE" : "JEQ";
+    if (command == "gt") return negate ? "JLE" : "JGT";
+    if (command == "lt") return negate ? "JGE" : "JLT";
+    throw std::runtime_error("Not a comparison: " + command);
+}
+
+void CodeWriter::writeCompareJump(const std::string& command, bool negate, const std::string& label) {
+    /**
+     * Fused translation of: eq|gt|lt [not] if-goto label
+     * Jumps on x - y directly instead of materializing a boolean.
+     * @param command the comparison (eq, gt, lt)
+     * @param negate true if the comparison was followed by not
+     * @param label the if-goto target
+     */
+    if (registerCount > 1) flushRegisters(); //the stack below x has to be in RAM at the jump
+    flushSP();
+    outputFile << "// " << command << (negate ? " not" : "") << " if-goto " << label << std::endl;
+    loadTop(); //y
+    if (registerCount == 1) {
+        outputFile << "@R13\n"; //x
+        registerCount = 0;
+    } else {
+        outputFile << "@SP\n"
+                   << "AM=M-1\n";
+    }
+    outputFile << "D=M-D\n" //x - y
+               << "@" << currentFunction << "$" << label << "\n"
+               << "D;" << jumpFor(command, negate) << "\n";
+    topInD = false;
+    outputFile << std::endl;
+}
+
+void CodeWriter::writeConstantCompareJump(const std::string& command, int constant, bool negate, const std::string& label) {
+    /**
+     * Fused translation of: push constant c, eq|gt|lt [not] if-goto label
+     * @param command the comparison (eq, gt, lt)
+     * @param constant the constant y the top of stack is compared against
+     * @param negate true if the comparison was followed by not
+     * @param label the if-goto target
+     */
+    flushRegisters();
+    flushSP();
+    outputFile << "// push constant " << constant << " " << command << (negate ? " not" : "") << " if-goto " << label << std::endl;
+    loadTop(); //x
+    if (constant == 1) {
+        outputFile << "D=D-1\n";
+    } else if (constant != 0) {
+        outputFile << "@" << constant << "\n"
+                   << "D=D-A\n";
+    }
+    outputFile << "@" << currentFunction << "$" << label << "\n"
+               << "D;" << jumpFor(command, negate) << "\n";
+    topInD = false;
+    outputFile << std::endl;
+}
+
+void CodeWriter::writeNotJump(const std::string& label) {
+    /**
+     * Fused translation of: not if-goto label
+     * not is bitwise, so the jump is taken unless the value was true (-1).
+     */
+    flushRegisters();
+    flushSP();
+    outputFile << "// not if-goto " << label << std::endl;
+    loadTop();
+    outputFile << "@" << currentFunction << "$" << label << "\n"
+               << "D+1;JNE\n";
+    topInD = false;
+    outputFile << std::endl;
+}
+
+void CodeWriter::writeMove(const std::string& srcSegment, int srcIndex, const std::string& dstSegment, int dstIndex) {
+    /**
+     * Fused translation of: push srcSegment srcIndex, pop dstSegment dstIndex
+     * The value goes through D and never touches the stack.
+     */
+    outputFile << "// push " << srcSegment << " " << srcIndex << " pop " << dstSegment << " " << dstIndex << std::endl;
+
+    if (srcSegment == "constant" && (srcIndex == 0 || srcIndex == 1) && isDirectSlot(dstSegment, dstIndex)) {
+        writeAddress(dstSegment, dstIndex, true); //leaves D (and a cached top) alone
+        outputFile << "M=" << srcIndex << "\n";
+    } else {
+        if (topInD) spillTop(); //free D, a batched SP can stay pending
+        writeLoadD(srcSegment, srcIndex);
+        writeStoreD(dstSegment, dstIndex);
+    }
+    outputFile << std::endl;
+}
+
+void CodeWriter::writeSlotUpdate(const std::string& segment, int index, const std::string& command, int constant) {
+    /**
+     * Fused translation of: push s i, push constant c, add|sub, pop s i
+     * Updates the slot in place, ex. M=M+1 for an increment.
+     * @param segment the memory segment of the slot
+     * @param index the index within the segment
+     * @param command add or sub
+     * @param constant the constant c
+     */
+    outputFile << "// push " << segment << " " << index << " push constant " << constant
+               << " " << command << " pop " << segment << " " << index << std::endl;
+
+    std::string op = command == "add" ? "+" : "-";
+    if (constant == 1) {
+        writeAddress(segment, index, topInD);
+        outputFile << "M=M" << op << "1\n";
+    } else {
+        if (topInD) spillTop(); //free D, a batched SP can stay pending
+        outputFile << "@" << constant << "\n"
+                   << "D=A\n";
+        writeAddress(segment, index, true);
+        outputFile << "M=M" << op << "D\n";
+    }
+    outputFile << std::endl;
+}
+
+void CodeWriter::writeConstantArithmetic(const std::string& command, int constant) {
+    /**
+     * Fused translation of: push constant c, add|sub|and|or
+     * The constant is applied to the top of stack without being pushed.
+     */
+    flushSP();
+    outputFile << "// push constant " << constant << " " << command << std::endl;
+
+    std::string op = command == "add" ? "+" : (command == "sub" ? "-" : (command == "and" ? "&" : "|"));
+    if (topInD) {
+        if (constant == 1 && (command == "add" || command == "sub")) {
+            outputFile << "D=D" << op << "1\n";
+        } else {
+            outputFile << "@" << constant << "\n"
+                       << "D=D" << op << "A\n";
+        }
+    } else if (constant == 1 && (command == "add" || command == "sub")) {
+        outputFile << "@SP\n"
+                   << "A=M-1\n"
+                   << "M=M" << op << "1\n";
+    } else {
+        outputFile << "@" << constant << "\n"
+                   << "D=A\n"
+                   << "@SP\n"
+                   << "A=M-1\n"
+                   << (command == "sub" ? "M=M-D\n" : "M=D" + op + "M\n");
+    }
+    outputFile << std::endl;
+}
+
+void CodeWriter::writeRegisterPush(const std::string& segment, int index) {
+    /**
+     * Push that moves the cached top into the next of R13-R15 instead of RAM,
+     * for a value that a later binary command or pop of the same basic block
+     * takes back (see Fuser::writeRegisterPush). Binary commands and pops find
+     * it there through registerCount, everything else spills the registers
+     * first. Falls back to a plain push when the top is in RAM or all three
+     * registers are taken.
+     * @param segment the memory segment to push from
+     * @param index the index within the segment
+     */
+    if (!cacheTop || !topInD || registerCount == 3) {
+        writePushPop("push", segment, index);
+        return;
+    }
+    outputFile << "// push " << segment << " " << index << " (R" << (13 + registerCount) << ")" << std::endl;
+    flushSP();
+    outputFile << "@R" << (13 + registerCount) << "\n"
+               << "M=D\n";
+    registerCount++;
+    writeLoadD(segment, index);
+    outputFile << std::endl;
+}
+
+//inline Math calls
+
+void CodeWriter::writeConstantMultiply(int constant) {
+    /**
+     * Inline translation of: push constant c, call Math.multiply 2
+     * The top of stack is multiplied by c with doubling and adding, walking the
+     * bits of c from the top (R13 = x, R14 = scratch for the doubling).
+     * @param constant the non negative constant operand
+     */
+    flushRegisters();
+    flushSP();
+    outputFile << "// push constant " << constant << " call Math.multiply 2 (inline)" << std::endl;
+
+    if (!topInD) {
+        outputFile << "@SP\n"
+                   << "A=M-1\n"
+                   << "D=M\n";
+    }
+
+    if (constant == 0) {
+        outputFile << "D=0\n";
+    } else if (constant > 1) {
+        int bit = 14;
+        while (!(constant & (1 << bit))) bit--;
+        outputFile << "@R13\n"
+                   << "M=D\n"; //R13 = x
+        for (bit--; bit >= 0; bit--) {
+            outputFile << "@R14\n"
+                       << "M=D\n"
+                       << "D=D+M\n"; //D = D * 2
+            if (constant & (1 << bit)) {
+                outputFile << "@R13\n"
+                           << "D=D+M\n"; //D = D + x
+            }
+        }
+    }
+
+    if (!topInD) {
+        outputFile << "@SP\n"
+                   << "A=M-1\n"
+                   << "M=D\n";
+    }
+    outputFile << std::endl;
+}
+
+void CodeWriter::writeMultiply() {
+    /**
+     * Inline translation of: call Math.multiply 2
+     * x and y are handed to the shared MATH_MULTIPLY routine in R13/R14 with the
+     * return address in R15, no frame is built. The product comes back in D.
+     */
+    flushRegisters();
+    flushSP();
+    std::string returnLabel = generateLabel("MULTIPLY_RETURN");
+    multiplyUsed = true;
+
+    outputFile << "// call Math.multiply 2 (inline)" << std::endl;
+
+    loadTop();
+    outputFile << "@R14\n"
+               << "M=D\n" //R14 = y
+               << "@SP\n"
+               << "AM=M-1\n"
+               << "D=M\n"
+               << "@R13\n"
+               << "M=D\n" //R13 = x
+               << "@" << returnLabel << "\n"
+               << "D=A\n"
+               << "@R15\n"
+               << "M=D\n"
+               << "@MATH_MULTIPLY\n"
+               << "0;JMP\n"
+               << "(" << returnLabel << ")\n";
+    topInD = true;
+    if (!cacheTop) {
+        spillTop();
+    }
+    outputFile << std::endl;
+}
+
+void CodeWriter::writeDivide() {
+    /**
+     * Inline translation of: call Math.divide 2
+     * Like writeMultiply, using the shared MATH_DIVIDE routine. Division by zero
+     * still calls Math.divide so the OS can report the error.
+     */
+    std::string returnLabel = generateLabel("DIVIDE_RETURN");
+    std::string callLabel = generateLabel("DIVIDE_CALL");
+    std::string endLabel = generateLabel("DIVIDE_END");
+    divideUsed = true;
+
+    outputFile << "// call Math.divide 2 (inline)" << std::endl;
+
+    spillTop();
+    outputFile << "@SP\n"
+               << "A=M-1\n"
+               << "D=M\n"
+               << "@" << callLabel << "\n"
+               << "D;JEQ\n"
+               << "@R14\n"
+               << "M=D\n" //R14 = y
+               << "@SP\n"
+               << "M=M-1\n"
+               << "AM=M-1\n"
+               << "D=M\n"
+               << "@R13\n"
+               << "M=D\n" //R13 = x
+               << "@" << returnLabel << "\n"
+               << "D=A\n"
+               << "@R15\n"
+               << "M=D\n"
+               << "@MATH_DIVIDE\n"
+               << "0;JMP\n"
+               << "(" << returnLabel << ")\n"
+               << "@SP\n"
+               << "A=M\n"
+               << "M=D\n"
+               << "@SP\n"
+               << "M=M+1\n"
+               << "@" << endLabel << "\n"
+               << "0;JMP\n"
+               << "(" << callLabel << ")\n";
+    writeFrameCall("Math.divide", 2);
+    outputFile << "(" << endLabel << ")\n";
+    outputFile << std::endl;
+}
+
+void CodeWriter::writeMultiplyRoutine() {
+    /**
+     * Shared multiply, see writeMultiply. R13 = x, R14 = y, R15 = return address.
+     * Adds x for every set bit of y while doubling x, clearing the bits of y as
+     * they are used so small multipliers finish early. RAM[SP] and RAM[SP+1]
+     * are free at this point and hold the sum and the current bit.
+     */
+    outputFile << "// multiply routine\n"
+               << "(MATH_MULTIPLY)\n"
+               << "@SP\n"
+               << "A=M\n"
+               << "M=0\n" //sum = 0
+               << "A=A+1\n"
+               << "M=1\n" //bit = 1
+               << "(MATH_MULTIPLY_LOOP)\n"
+               << "@SP\n"
+               << "A=M+1\n"
+               << "D=M\n"
+               << "@R14\n"
+               << "D=D&M\n"
+               << "@MATH_MULTIPLY_SKIP\n"
+               << "D;JEQ\n"
+               << "@R14\n"
+               << "M=M-D\n" //clear the bit in y
+               << "@R13\n"
+               << "D=M\n"
+               << "@SP\n"
+               << "A=M\n"
+               << "M=D+M\n" //sum += x
+               << "(MATH_MULTIPLY_SKIP)\n"
+               << "@R13\n"
+               << "D=M\n"
+               << "M=D+M\n" //x += x
+               << "@SP\n"
+               << "A=M+1\n"
+               << "D=M\n"
+               << "M=D+M\n" //bit += bit
+               << "@R14\n"
+               << "D=M\n"
+               << "@MATH_MULTIPLY_LOOP\n"
+               << "D;JNE\n"
+               << "@SP\n"
+               << "A=M\n"
+               << "D=M\n"
+               << "@R15\n"
+               << "A=M\n"
+               << "0;JMP\n";
+    outputFile << std::endl;
+}
+
+void CodeWriter::writeDivideRoutine() {
+    /**
+     * Shared divide, see writeDivide. R13 = x, R14 = y (not 0), R15 = return address.
+     * Long division of |x| by |y| over all 16 bits, treated as unsigned so -32768
+     * works, then the sign is applied. Scratch above the stack:
+     * RAM[SP] = negate flag, RAM[SP+1] = remainder, RAM[SP+2] = quotient, RAM[SP+3] = bits left.
+     */
+    outputFile << "// divide routine\n"
+               << "(MATH_DIVIDE)\n"
+               << "@SP\n"
+               << "A=M\n"
+               << "M=0\n" //negate = 0
+               << "A=A+1\n"
+               << "M=0\n" //remainder = 0
+               << "A=A+1\n"
+               << "M=0\n" //quotient = 0
+               << "@16\n"
+               << "D=A\n"
+               << "@SP\n"
+               << "A=M+1\n"
+               << "A=A+1\n"
+               << "A=A+1\n"
+               << "M=D\n" //bits left = 16
+               << "@R13\n"
+               << "D=M\n"
+               << "@MATH_DIVIDE_X_POSITIVE\n"
+               << "D;JGE\n"
+               << "@R13\n"
+               << "M=-M\n"
+               << "@SP\n"
+               << "A=M\n"
+               << "M=!M\n"
+               << "(MATH_DIVIDE_X_POSITIVE)\n"
+               << "@R14\n"
+               << "D=M\n"
+               << "@MATH_DIVIDE_LOOP\n"
+               << "D;JGE\n"
+               << "@R14\n"
+               << "M=-M\n"
+               << "@SP\n"
+               << "A=M\n"
+               << "M=!M\n"
+               << "(MATH_DIVIDE_LOOP)\n"
+               << "@SP\n"
+               << "A=M+1\n"
+               << "D=M\n"
+               << "M=D+M\n" //remainder += remainder
+               << "@R13\n"
+               << "D=M\n"
+               << "M=D+M\n" //shift the top bit out of x
+               << "@MATH_DIVIDE_SHIFTED\n"
+               << "D;JGE\n"
+               << "@SP\n"
+               << "A=M+1\n"
+               << "M=M+1\n" //into the remainder
+               << "(MATH_DIVIDE_SHIFTED)\n"
+               << "@SP\n"
+               << "A=M+1\n"
+               << "A=A+1\n"
+               << "D=M\n"
+               << "M=D+M\n" //quotient += quotient
+               << "@SP\n"
+               << "A=M+1\n"
+               << "D=M\n"
+               << "@MATH_DIVIDE_SUBTRACT\n"
+               << "D;JLT\n" //remainder >= 32768 is always >= |y|
+               << "@R14\n"
+               << "D=D-M\n"
+               << "@MATH_DIVIDE_NEXT\n"
+               << "D;JLT\n"
+               << "(MATH_DIVIDE_SUBTRACT)\n"
+               << "@R14\n"
+               << "D=M\n"
+               << "@SP\n"
+               << "A=M+1\n"
+               << "M=M-D\n" //remainder -= |y|
+               << "A=A+1\n"
+               << "M=M+1\n" //quotient += 1
+               << "(MATH_DIVIDE_NEXT)\n"
+               << "@SP\n"
+               << "A=M+1\n"
+               << "A=A+1\n"
+               << "A=A+1\n"
+               << "MD=M-1\n"
+               << "@MATH_DIVIDE_LOOP\n"
+               << "D;JGT\n"
+               << "@SP\n"
+               << "A=M+1\n"
+               << "A=A+1\n"
+               << "D=M\n"
+               << "@R13\n"
+               << "M=D\n" //R13 = quotient
+               << "@SP\n"
+               << "A=M\n"
+               << "D=M\n"
+               << "@MATH_DIVIDE_END\n"
+               << "D;JEQ\n"
+               << "@R13\n"
+               << "M=-M\n"
+               << "(MATH_DIVIDE_END)\n"
+               << "@R13\n"
+               << "D=M\n"
+               << "@R15\n"
+               << "A=M\n"
+               << "0;JMP\n";
+    outputFile << std::endl;
+}
+
+//native OS routines
+
+bool CodeWriter::writeNativeCall(const std::string& functionName, int numArgs) {
+    /**
+     * Translation of a call to an OS function that has a native version.
+     * Arguments the native code cannot handle (ex. a negative number for
+     * Math.sqrt) still go to the compiled function, so the OS reports the error.
+     * @return false if the function has no native version, nothing is written
+     */
+    if (!hasNative(functionName, numArgs)) {
+        return false;
+    }
+    if (functionName == "Math.multiply") {
+        writeMultiply();
+        return true;
+    }
+    if (functionName == "Math.divide") {
+        writeDivide();
+        return true;
+    }
+    const NativeRoutine& routine = nativeRoutines().at(functionName);
+    std::string prefix = generateLabel("NATIVE");
+
+    outputFile << "// call " << functionName << " " << numArgs << " (native)" << std::endl;
+    if (!routine.guard.empty()) {
+        outputFile << "@SP\n"
+                   << "A=M-1\n"
+                   << "D=M\n"
+                   << "@" << prefix << "_CALL\n"
+                   << "D;" << routine.guard << "\n";
+    }
+
+    if (routine.shared) {
+        nativeUsed.insert(functionName);
+        outputFile << "@" << prefix << "_RETURN\n"
+                   << "D=A\n"
+                   << "@R15\n"
+                   << "M=D\n"
+                   << "@NATIVE_" << functionName << "\n"
+                   << "0;JMP\n"
+                   << "(" << prefix << "_RETURN)\n";
+    } else {
+        std::string code = routine.code;
+        for (size_t pos = code.find('$'); pos != std::string::npos; pos = code.find('$', pos)) {
+            code.replace(pos, 1, prefix + "_");
+        }
+        outputFile << code;
+    }
+
+    if (!routine.guard.empty()) {
+        outputFile << "@" << prefix << "_END\n"
+                   << "0;JMP\n"
+                   << "(" << prefix << "_CALL)\n";
+        writeFrameCall(functionName, numArgs);
+        outputFile << "(" << prefix << "_END)\n";
+    }
+    outputFile << std::endl;
+    return true;
+}
+
+void CodeWriter::writeNativeRoutine(const std::string& functionName) {
+    /**
+     * Shared native routine, entered at NATIVE_<function> with the return
+     * address in R15, see writeNativeCall.
+     */
+    std::string code = nativeRoutines().at(functionName).code;
+    std::string prefix = "NATIVE_" + functionName;
+    for (size_t pos = code.find('$'); pos != std::string::npos; pos = code.find('$', pos)) {
+        code.replace(pos, 1, prefix + "_");
+    }
+    outputFile << "// native " << functionName << "\n"
+               << "(" << prefix << ")\n"
+               << code;
+    outputFile << std::endl;
+}
+
+//chapter 8 methods
+
+void CodeWriter::writeInit() {
+    /**
+     * Writes the assembly code that effects the VM initialization,
+     * also called bootstrap code. This code must be placed at the
+     * beginning of the output file.
+     */
+    writeMarker("- - bootstrap");
+    outputFile << "// Bootstrap code\n"
+               << "@256\n"
+               << "D=A\n"
+               << "@SP\n"
+               << "M=D\n";
+    
+    writeCall("Sys.init", 0); //call Sys.init with 0 args
+}
+
+void CodeWriter::writeLabel(const std::string& label) {
+    /**
+     * Writes the assembly code that is the translation of the given label command.
+     * The label is function-scoped and uses the format functionName$label.
+     * Example: (SimpleFunction$LOOP)
+     * @param label the label to declare
+     */
+    spillTop(); //jumps arrive with the stack in RAM
+    outputFile << "// label " << label << std::endl;
+    outputFile << "(" << currentFunction << "$" << label << ")\n"; //functionName$label ex. SimpleFunction$LOOP
+    outputFile << std::endl;
+}
+
+void CodeWriter::writeGoto(const std::string& label) {
+    /**
+     * Writes the assembly code that is the translation of the given goto command.
+     * Unconditional jump to a function-scoped label using the format functionName$label.
+     * Example: @SimpleFunction$LOOP 0;JMP
+     * @param label the label to go to
+     */
+    spillTop();
+    outputFile << "// goto " << label << std::endl;
+    outputFile << "@" << currentFunction << "$" << label << "\n" //functionName$label
+               << "0;JMP\n";
+    outputFile << std::endl;
+}
+
+void CodeWriter::writeIf(const std::string& label) {
+    /**
+     * Writes the assembly code that is the translation of the given if-goto command.
+     * Conditional jump to a function-scoped label using the format functionName$label.
+     * Example: @SimpleFunction$LOOP D;JNE
+     * @param label the label to go to if top stack value != 0
+     */
+    outputFile << "// if-goto " << label << std::endl;
+    if (cacheTop) {
+        flushRegisters();
+        loadTop(); //condition is consumed, both paths continue with the stack in RAM
+        topInD = false;
+    } else if (spOffset != 0) { //batched SP: pop the condition while writing SP back
+        spOffset--;
+        flushSP();
+        outputFile << "@SP\n"
+                   << "A=M\n"
+                   << "D=M\n";
+    } else {
+        outputFile << "@SP\n"
+                   << "AM=M-1\n"
+                   << "D=M\n";
+    }
+    outputFile << "@" << currentFunction << "$" << label << "\n" //functionName$label
+               << "D;JNE\n";
+    outputFile << std::endl;
+}
+
+void CodeWriter::writeCall(const std::string& functionName, int numArgs) {
+    /**
+     * Writes the assembly code that is the translation of the given call command.
+     * 
+     * process: 
+     * push return-address; //unique label for return address
+     * push LCL; //save LCL of caller for later restoration
+     * push ARG; //save ARG of caller for later restoration
+     * push THIS; //save THIS of caller for later restoration
+     * push THAT; //save THAT of caller for later restoration
+     * ARG = SP-n-5; //reposition ARG for callee
+     * LCL = SP;  //reposition LCL for callee
+     * goto functionName; (return-address) //transfer control to callee
+     * 
+     * @param functionName the name of the function to call ex. Sys.init
+     * @param numArgs the number of arguments to pass to the function
+     */
+    spillTop();
+    if (writeNativeCall(functionName, numArgs)) {
+        return;
+    }
+    writeFrameCall(functionName, numArgs);
+}
+
+void CodeWriter::writeVoidCall(const std::string& functionName, int numArgs) {
+    /**
+     * Translation of: call f n, pop temp 0 where f returns nothing.
+     * Native code still leaves a result, it is dropped without a store.
+     */
+    writeCall(functionName, numArgs);
+    if (!hasNative(functionName, numArgs)) return;
+    if (topInD) {
+        topInD = false;
+    } else {
+        outputFile << "@SP\n"
+                   << "M=M-1\n";
+    }
+    outputFile << std::endl;
+}
+
+void CodeWriter::writeFrameCall(const std::string& functionName, int numArgs) {
+    /**
+     * Call of the compiled function, see writeCall. The stack is in RAM.
+     */
+    auto frame = staticFrames.find(functionName);
+    if (frame != staticFrames.end()) {
+        writeStaticCall(functionName, numArgs, frame->second);
+        return;
+    }
+
+    std::string returnLabel = labelPrefix() + "RETURN_" + std::to_string(++callCounter); //unique return label
+    bool light = lightFunctions.count(functionName) > 0; //THIS/THAT survive the call, don't save them
+    int frameWords = light ? 3 : 5;
+    
+    outputFile << "// call " << functionName << " " << numArgs << std::endl;
+    
+    // Push return address to stack
+    outputFile << "@" << returnLabel << "\n"
+               << "D=A\n"
+               << "@SP\n"
+               << "A=M\n"
+               << "M=D\n"
+               << "@SP\n"
+               << "M=M+1\n";
+    
+    // Push LCL to save caller's LCL for later restoration
+    outputFile << "@LCL\n"
+               << "D=M\n"
+               << "@SP\n"
+               << "A=M\n"
+               << "M=D\n"
+               << "@SP\n"
+               << "M=M+1\n";
+    
+    // Push ARG
+    outputFile << "@ARG\n"
+               << "D=M\n"
+               << "@SP\n"
+               << "A=M\n"
+               << "M=D\n"
+               << "@SP\n"
+               << "M=M+1\n";
+    
+    if (!light) {
+        // Push THIS
+        outputFile << "@THIS\n"
+                   << "D=M\n"
+                   << "@SP\n"
+                   << "A=M\n"
+                   << "M=D\n"
+                   << "@SP\n"
+                   << "M=M+1\n";
+        
+        // Push THAT
+        outputFile << "@THAT\n"
+                   << "D=M\n"
+                   << "@SP\n"
+                   << "A=M\n"
+                   << "M=D\n"
+                   << "@SP\n"
+                   << "M=M+1\n";
+    }
+    
+    // ARG = SP - n - 5 (SP - n - 3 for a light callee)
+    outputFile << "@SP\n" //get current SP
+               << "D=M\n" //D = SP
+               << "@" << (numArgs + frameWords) << "\n" // subtract (numArgs + 5) from SP: SP - numArgs - 5
+               << "D=D-A\n" // D = SP - numArgs - 5
+               << "@ARG\n" //set ARG 
+               << "M=D\n"; //ARG = SP - n - 5 ARG now points to base of args for callee
+    
+    // LCL = SP
+    outputFile << "@SP\n" //reposition LCL for callee
+               << "D=M\n" //D = SP
+               << "@LCL\n" //set LCL
+               << "M=D\n"; //LCL = SP
+    
+    // goto functionName
+    outputFile << "@" << functionName << "\n"
+               << "0;JMP\n";
+    
+    // (return address)
+    outputFile << "(" << returnLabel << ")\n";
+    outputFile << std::endl;
+}
+
+void CodeWriter::writeReturn() {
+    /**
+     * Writes the assembly code that is the translation of the given return command.
+     * 
+     * process:
+     * FRAME = LCL; //FRAME is a temporary variable
+     * RET = *(FRAME-5); //get return address
+     * *ARG = pop(); //reposition return value for caller
+     * SP = ARG + 1; //restore SP of caller
+     * THAT = *(FRAME-1); //restore THAT of caller
+     * THIS = *(FRAME-2); //restore THIS of caller
+     * ARG = *(FRAME-3); //restore ARG of caller
+     * LCL = *(FRAME-4); //restore LCL of caller
+     * goto RET; //goto return address
+     * 
+     * Light functions have no THIS/THAT in their frame, RET is *(FRAME-3) and
+     * ARG/LCL are one and two words below FRAME.
+     * Void functions (see setVoidFunctions) return nothing: SP = ARG.
+     */
+    spillTop();
+    writeProfileExit();
+    if (currentFrame != nullptr) {
+        writeStaticReturn();
+        return;
+    }
+
+    outputFile << "// return\n";
     
     // FRAME = LCL (using R13 as FRAME)
     outputFile << "@LCL\n"
@@ -430,39 +1625,43 @@ void CodeWriter::writeReturn() {
                << "M=D\n";
     
     // RET = *(FRAME-5) (using R14 as RET)
-    outputFile << "@5\n"
+    outputFile << "@" << (currentLight ? 3 : 5) << "\n"
                << "A=D-A\n"
                << "D=M\n"
                << "@R14\n"
                << "M=D\n";
     
     // *ARG = pop()
-    outputFile << "@SP\n"
-               << "AM=M-1\n"
-               << "D=M\n"
-               << "@ARG\n"
-               << "A=M\n"
-               << "M=D\n";
+    if (!returnsVoid()) {
+        outputFile << "@SP\n"
+                   << "AM=M-1\n"
+                   << "D=M\n"
+                   << "@ARG\n"
+                   << "A=M\n"
+                   << "M=D\n";
+    }
     
     // SP = ARG + 1
     outputFile << "@ARG\n"
-               << "D=M+1\n"
+               << (returnsVoid() ? "D=M\n" : "D=M+1\n")
                << "@SP\n"
                << "M=D\n";
     
-    // THAT = *(FRAME-1)
-    outputFile << "@R13\n"
-               << "AM=M-1\n"
-               << "D=M\n"
-               << "@THAT\n"
-               << "M=D\n";
-    
-    // THIS = *(FRAME-2)
-    outputFile << "@R13\n"
-               << "AM=M-1\n"
-               << "D=M\n"
-               << "@THIS\n"
-               << "M=D\n";
+    if (!currentLight) {
+        // THAT = *(FRAME-1)
+        outputFile << "@R13\n"
+                   << "AM=M-1\n"
+                   << "D=M\n"
+                   << "@THAT\n"
+                   << "M=D\n";
+        
+        // THIS = *(FRAME-2)
+        outputFile << "@R13\n"
+                   << "AM=M-1\n"
+                   << "D=M\n"
+                   << "@THIS\n"
+                   << "M=D\n";
+    }
     
     // ARG = *(FRAME-3)
     outputFile << "@R13\n"
@@ -497,10 +1696,24 @@ void CodeWriter::writeFunction(const std::string& functionName, int numLocals) {
      * @param functionName the name of the function
      * @param numLocals the number of local variables to initialize
      */
+    spillTop();
     currentFunction = functionName;
+    auto frame = staticFrames.find(functionName);
+    currentFrame = frame != staticFrames.end() ? &frame->second : nullptr;
+    currentLight = lightFunctions.count(functionName) > 0;
     
     outputFile << "// function " << functionName << " " << numLocals << std::endl;
     outputFile << "(" << functionName << ")\n";
+    writeProfileEntry();
+
+    if (currentFrame != nullptr) { //locals live in the static frame
+        for (int i = 0; i < numLocals; i++) {
+            outputFile << "@" << currentFrame->local(i) << "\n"
+                       << "M=0\n";
+        }
+        outputFile << std::endl;
+        return;
+    }
     
     //initialize local variables to 0 by pushing 0 onto stack numLocals times
     for (int i = 0; i < numLocals; i++) {
@@ -513,8 +1726,263 @@ void CodeWriter::writeFunction(const std::string& functionName, int numLocals) {
     outputFile << std::endl;
 }
 
+void CodeWriter::writeStaticCall(const std::string& functionName, int numArgs, const StaticFrame& frame) {
+    /**
+     * Calls a function with a static frame. The arguments are moved from the
+     * stack into the callee's frame, which also keeps the return address, the
+     * caller's SP (where the return value goes) and THIS/THAT, unless the callee
+     * is light. LCL and ARG are left alone, the callee never uses them.
+     * @param functionName the function to call
+     * @param numArgs the number of arguments on the stack
+     * @param frame the callee's frame
+     */
+    std::string returnLabel = labelPrefix() + "RETURN_" + std::to_string(++callCounter);
+
+    outputFile << "// call " << functionName << " " << numArgs << " (static frame)" << std::endl;
+
+    for (int i = numArgs - 1; i >= 0; i--) {
+        outputFile << "@SP\n"
+                   << "AM=M-1\n"
+                   << "D=M\n"
+                   << "@" << frame.argument(i) << "\n"
+                   << "M=D\n";
+    }
+
+    outputFile << "@SP\n"
+               << "D=M\n"
+               << "@" << frame.savedSP() << "\n"
+               << "M=D\n";
+    if (lightFunctions.count(functionName) == 0) {
+        outputFile << "@THIS\n"
+                   << "D=M\n"
+                   << "@" << frame.savedThis() << "\n"
+                   << "M=D\n"
+                   << "@THAT\n"
+                   << "D=M\n"
+                   << "@" << frame.savedThat() << "\n"
+                   << "M=D\n";
+    }
+    outputFile << "@" << returnLabel << "\n"
+               << "D=A\n"
+               << "@" << frame.returnAddress() << "\n"
+               << "M=D\n"
+               << "@" << functionName << "\n"
+               << "0;JMP\n"
+               << "(" << returnLabel << ")\n";
+    outputFile << std::endl;
+}
+
+void CodeWriter::writeStaticReturn() {
+    /**
+     * Returns from a function with a static frame: the return value goes where
+     * the caller's SP pointed, SP is set just past it and THIS/THAT are restored
+     * unless the function is light. Void functions return nothing.
+     */
+    const StaticFrame& frame = *currentFrame;
+
+    outputFile << "// return (static frame)\n";
+    if (!returnsVoid()) {
+        outputFile << "@SP\n"
+                   << "AM=M-1\n"
+                   << "D=M\n"
+                   << "@" << frame.savedSP() << "\n"
+                   << "A=M\n"
+                   << "M=D\n";
+    }
+    outputFile << "@" << frame.savedSP() << "\n"
+               << (returnsVoid() ? "D=M\n" : "D=M+1\n")
+               << "@SP\n"
+               << "M=D\n";
+    if (!currentLight) {
+        outputFile << "@" << frame.savedThis() << "\n"
+                   << "D=M\n"
+                   << "@THIS\n"
+                   << "M=D\n"
+                   << "@" << frame.savedThat() << "\n"
+                   << "D=M\n"
+                   << "@THAT\n"
+                   << "M=D\n";
+    }
+    outputFile << "@" << frame.returnAddress() << "\n"
+               << "A=M\n"
+               << "0;JMP\n";
+    outputFile << std::endl;
+}
+
+void CodeWriter::writeTailCall(const std::string& functionName, int numArgs) {
+    /**
+     * Writes a call that is directly followed by return. The callee reuses the
+     * current frame: its arguments and the caller's saved frame are moved down
+     * to ARG, so it returns straight to our caller and the stack does not grow.
+     * 
+     * process:
+     * copy saved frame (LCL-5..LCL-1, 3 words if light) to SP..SP+4;
+     * move the n arguments and the saved frame down to ARG;
+     * LCL = SP = ARG+n+5;
+     * goto functionName;
+     * 
+     * Calls that involve a static frame or switch between the full and the light
+     * frame are written as a normal call and return.
+     * @param functionName the name of the function to call
+     * @param numArgs the number of arguments on the stack
+     */
+    spillTop();
+    if (writeNativeCall(functionName, numArgs)) { //no frame to reuse
+        writeReturn();
+        return;
+    }
+    bool light = lightFunctions.count(functionName) > 0;
+    if (currentFrame != nullptr || staticFrames.count(functionName) || light != currentLight) {
+        writeCall(functionName, numArgs);
+        writeReturn();
+        return;
+    }
+    spillTop();
+    writeProfileExit(); //the callee returns straight to our caller
+    tailCallUsed = true;
+    int frameWords = light ? 3 : 5;
+
+    outputFile << "// tail call " << functionName << " " << numArgs << std::endl;
+
+    //copy the saved frame above the arguments
+    for (int i = 1; i <= frameWords; i++) {
+        outputFile << "@LCL\n"
+                   << "D=M\n"
+                   << "@" << i << "\n"
+                   << "A=D-A\n"
+                   << "D=M\n"
+                   << "@SP\n"
+                   << "A=M\n";
+        for (int j = 0; j < frameWords - i; j++) {
+            outputFile << "A=A+1\n";
+        }
+        outputFile << "M=D\n";
+    }
+
+    outputFile << "@SP\n"
+               << "D=M\n"
+               << "@" << numArgs << "\n"
+               << "D=D-A\n"
+               << "@R15\n"
+               << "M=D\n" //R15 = first argument
+               << "@" << (numArgs + frameWords) << "\n"
+               << "D=A\n"
+               << "@R13\n"
+               << "M=D\n" //R13 = words to move
+               << "@" << functionName << "\n"
+               << "D=A\n"
+               << "@R14\n"
+               << "M=D\n" //R14 = callee
+               << "@TAIL_CALL\n"
+               << "0;JMP\n";
+    outputFile << std::endl;
+}
+
+void CodeWriter::writeTailCallRoutine() {
+    /**
+     * Shared part of every tail call, see writeTailCall.
+     * R13 = words to move (arguments and saved frame), R14 = callee, R15 = first argument.
+     * SP is used as the destination pointer while copying, so it ends at the new LCL.
+     */
+    outputFile << "// tail call routine\n"
+               << "(TAIL_CALL)\n"
+               << "@ARG\n"
+               << "D=M\n"
+               << "@SP\n"
+               << "M=D\n" //SP = destination
+               << "(TAIL_CALL_LOOP)\n"
+               << "@R15\n"
+               << "AM=M+1\n"
+               << "A=A-1\n"
+               << "D=M\n"
+               << "@SP\n"
+               << "AM=M+1\n"
+               << "A=A-1\n"
+               << "M=D\n"
+               << "@R13\n"
+               << "MD=M-1\n"
+               << "@TAIL_CALL_LOOP\n"
+               << "D;JGT\n"
+               << "@SP\n"
+               << "D=M\n"
+               << "@LCL\n"
+               << "M=D\n" //LCL = SP
+               << "@R14\n"
+               << "A=M\n"
+               << "0;JMP\n";
+    outputFile << std::endl;
+}
+
+void CodeWriter::writeProfileEntry() {
+    /**
+     * Counts a call of the current function, the high word is incremented when
+     * the low word wraps to 0. With a clock, subtracts its value from the time
+     * accumulator, writeProfileExit adds it back.
+     */
+    auto slot = profileSlots.find(currentFunction);
+    if (slot == profileSlots.end()) return;
+    std::string noCarry = generateLabel("PROFILE");
+
+    outputFile << "@" << slot->second << "\n"
+               << "M=M+1\n"
+               << "D=M\n"
+               << "@" << noCarry << "\n"
+               << "D;JNE\n"
+               << "@" << slot->second + 1 << "\n"
+               << "M=M+1\n"
+               << "(" << noCarry << ")\n";
+    if (profileClock >= 0) {
+        outputFile << "@" << profileClock << "\n"
+                   << "D=M\n"
+                   << "@" << slot->second + 2 << "\n"
+                   << "M=M-D\n";
+    }
+}
+
+void CodeWriter::writeProfileExit() {
+    /**
+     * Adds the clock to the time accumulator of the current function when it
+     * returns, so the accumulator holds the sum of exit - entry over its calls.
+     */
+    auto slot = profileSlots.find(currentFunction);
+    if (slot == profileSlots.end() || profileClock < 0) return;
+
+    outputFile << "@" << profileClock << "\n"
+               << "D=M\n"
+               << "@" << slot->second + 2 << "\n"
+               << "M=M+D\n";
+}
+
 void CodeWriter::close() {
-    if (outputFile.is_open()) {
-        outputFile.close();
+    if (outputFile.rdbuf() != nullptr) {
+        spillTop(); //leave the final stack in RAM
+        if (tailCallUsed) {
+            writeMarker("- - TAIL_CALL");
+            writeTailCallRoutine();
+        }
+        if (multiplyUsed) {
+            writeMarker("- - MATH_MULTIPLY");
+            writeMultiplyRoutine();
+        }
+        if (divideUsed) {
+            writeMarker("- - MATH_DIVIDE");
+            writeDivideRoutine();
+        }
+        for (const auto& name : nativeUsed) {
+            writeMarker("- - NATIVE_" + name);
+            writeNativeRoutine(name);
+        }
+        outputFile.flush();
+        outputFile.rdbuf(nullptr);
+        if (file.is_open()) file.close();
     }
+}
+
+void CodeWriter::flush() {
+    /**
+     * Pushes everything written so far to the output, so a reader on the
+     * other end of a pipe gets each function as soon as it is translated.
+     * The cached top of stack stays in D, it is not part of the output yet.
+     */
+    outputFile.flush();
 }
\ No newline at end of file
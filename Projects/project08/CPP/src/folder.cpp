@@ -0,0 +1,148 @@
+#include "folder.h"
+#include <fstream>
+#include <sstream>
+#include <set>
+#include <filesystem>
+
+std::string FunctionFolder::normalize(const std::vector<VMCommand>& commands, size_t start, size_t end, const std::string& file) {
+    /**
+     * Key for the function in commands[start, end): its commands without the
+     * name, with labels numbered in order of appearance so the key does not
+     * depend on what they were called. static belongs to the file, so it is
+     * tagged with the file name.
+     */
+    std::map<std::string, int> labels;
+    std::ostringstream key;
+    key << commands[start].arg2 << "\n"; //number of locals
+
+    for (size_t pos = start + 1; pos < end; pos++) {
+        VMCommand command = commands[pos];
+        if (command.type == CommandType::C_LABEL || command.type == CommandType::C_GOTO || command.type == CommandType::C_IF) {
+            auto it = labels.emplace(command.arg1, static_cast<int>(labels.size())).first;
+            command.arg1 = "L" + std::to_string(it->second);
+        } else if (command.arg1 == "static") {
+            command.arg1 = "static@" + file;
+        }
+        key << formatCommand(command) << "\n";
+    }
+    return key.str();
+}
+
+bool FunctionFolder::foldOnce(std::vector<VMFile>& program) {
+    /**
+     * Finds functions with the same normalized body, points every call to the
+     * first copy and drops the others.
+     * @return true if any function was folded
+     */
+    std::set<std::string> called;
+    for (const auto& file : program) {
+        for (const auto& command : file.commands) {
+            if (command.type == CommandType::C_CALL) called.insert(command.arg1);
+        }
+    }
+
+    std::map<std::string, std::string> firstWithKey; //key -> function kept
+    std::map<std::string, std::string> folded; //function -> function kept
+    for (const auto& file : program) {
+        std::string fileName = std::filesystem::path(file.path).stem().string();
+        const auto& commands = file.commands;
+        for (size_t start = 0; start < commands.size(); start++) {
+            if (commands[start].type != CommandType::C_FUNCTION) continue;
+            size_t end = start + 1;
+            while (end < commands.size() && commands[end].type != CommandType::C_FUNCTION) end++;
+
+            const std::string& name = commands[start].arg1;
+            auto first = firstWithKey.emplace(normalize(commands, start, end, fileName), name).first;
+            //entry points stay: Sys.init and functions only called from outside the program
+            if (first->second != name && name != "Sys.init" && called.count(name)) {
+                folded[name] = first->second;
+            }
+            start = end - 1;
+        }
+    }
+    if (folded.empty()) return false;
+
+    for (auto& file : program) {
+        std::vector<VMCommand> out;
+        bool skipping = false;
+        for (auto command : file.commands) {
+            if (command.type == CommandType::C_FUNCTION) {
+                skipping = folded.count(command.arg1) > 0;
+            }
+            if (skipping) continue;
+            if (command.type == CommandType::C_CALL && folded.count(command.arg1)) {
+                command.arg1 = folded[command.arg1];
+            }
+            out.push_back(command);
+        }
+        file.commands = out;
+    }
+
+    for (auto& alias : aliases) { //earlier folds into a function that was folded now
+        if (folded.count(alias.second)) alias.second = folded[alias.second];
+    }
+    aliases.insert(folded.begin(), folded.end());
+    return true;
+}
+
+int FunctionFolder::fold(std::vector<VMFile>& program) {
+    /**
+     * Folds identical functions across the whole program. Repeats, since
+     * callers of folded functions can become identical themselves.
+     * @param program every file of the program, changed in place
+     * @return the number of functions folded
+     */
+    while (foldOnce(program)) {}
+    return static_cast<int>(aliases.size());
+}
+
+std::string FunctionFolder::report(const std::map<std::string, int>& functionWords) const {
+    /**
+     * One line per folded function and the ROM words saved, each folded copy
+     * would have been as long as the one that was kept.
+     * @param functionWords words per function in the output, see countWords
+     */
+    std::ostringstream report;
+    int saved = 0;
+    for (const auto& alias : aliases) {
+        auto words = functionWords.find(alias.second);
+        int size = words == functionWords.end() ? 0 : words->second;
+        report << "  " << alias.first << " -> " << alias.second << ": " << size << " words\n";
+        saved += size;
+    }
+    report << "Folded " << aliases.size() << " functions, " << saved << " ROM words saved";
+    return report.str();
+}
+
+std::map<std::string, int> FunctionFolder::countWords(const std::string& asmFile, const std::vector<VMFile>& program) {
+    /**
+     * Counts the instructions of every function in a translated .asm file,
+     * from its label up to the next function label.
+     * @return function name -> ROM words
+     */
+    std::set<std::string> functions;
+    for (const auto& file : program) {
+        for (const auto& command : file.commands) {
+            if (command.type == CommandType::C_FUNCTION) functions.insert(command.arg1);
+        }
+    }
+
+    std::ifstream input(asmFile);
+    std::map<std::string, int> words;
+    std::string current;
+    std::string line;
+    while (std::getline(input, line)) {
+        line = line.substr(0, line.find("//"));
+        line.erase(0, line.find_first_not_of(" \t\r"));
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        if (line.empty()) continue;
+
+        if (line[0] == '(') {
+            std::string label = line.substr(1, line.size() - 2);
+            if (functions.count(label)) current = label;
+        } else if (!current.empty()) {
+            words[current]++;
+        }
+    }
+    return words;
+}
@@ -0,0 +1,218 @@
+#include "fuser.h"
+
+Fuser::Fuser(CodeWriter& codeWriter) : codeWriter(codeWriter) {}
+
+bool Fuser::isComparison(const VMCommand& command) {
+    return command.type == CommandType::C_ARITHMETIC &&
+           (command.arg1 == "eq" || command.arg1 == "gt" || command.arg1 == "lt");
+}
+
+bool Fuser::isArithmetic(const VMCommand& command, const std::string& name) {
+    return command.type == CommandType::C_ARITHMETIC && command.arg1 == name;
+}
+
+bool Fuser::isCall(const VMCommand& command, const std::string& name) {
+    return command.type == CommandType::C_CALL && command.arg1 == name && command.arg2 == 2;
+}
+
+size_t Fuser::writeFused(const std::vector<VMCommand>& commands, size_t pos) {
+    /**
+     * Looks for a window of commands starting at pos that CodeWriter can emit
+     * as a single fused sequence. Windows never extend past a label, so every
+     * jump target still starts a fresh window.
+     *
+     * patterns:
+     * eq|gt|lt [not] if-goto L                      -> D;Jxx on x - y
+     * push constant c, eq|gt|lt [not] if-goto L     -> D;Jxx on x - c
+     * not, if-goto L                                -> D+1;JNE
+     * push s i, push constant c, add|sub, pop s i   -> M=M+1 / M=M+D in place
+     * push s1 i, pop s2 j                           -> move through D
+     * push constant c, add|sub|and|or               -> constant operand
+     *
+     * @param commands the commands of the current file
+     * @param pos the index of the first command of the window
+     * @return the number of commands consumed, 0 if nothing matched
+     */
+    size_t left = commands.size() - pos;
+    const VMCommand& first = commands[pos];
+
+    //eq|gt|lt [not] if-goto L
+    if (isComparison(first) && left >= 2) {
+        bool negate = isArithmetic(commands[pos + 1], "not");
+        size_t jump = pos + (negate ? 2 : 1);
+        if (jump < commands.size() && commands[jump].type == CommandType::C_IF) {
+            codeWriter.writeCompareJump(first.arg1, negate, commands[jump].arg1);
+            return jump - pos + 1;
+        }
+    }
+
+    //not, if-goto L
+    if (isArithmetic(first, "not") && left >= 2 && commands[pos + 1].type == CommandType::C_IF) {
+        codeWriter.writeNotJump(commands[pos + 1].arg1);
+        return 2;
+    }
+
+    if (first.type != CommandType::C_PUSH || left < 2) {
+        return 0;
+    }
+    const VMCommand& second = commands[pos + 1];
+
+    //push constant c, eq|gt|lt [not] if-goto L
+    if (first.arg1 == "constant" && isComparison(second) && left >= 3) {
+        bool negate = isArithmetic(commands[pos + 2], "not");
+        size_t jump = pos + (negate ? 3 : 2);
+        if (jump < commands.size() && commands[jump].type == CommandType::C_IF) {
+            codeWriter.writeConstantCompareJump(second.arg1, first.arg2, negate, commands[jump].arg1);
+            return jump - pos + 1;
+        }
+    }
+
+    //push s i, push constant c, add|sub, pop s i
+    if (first.arg1 != "constant" && left >= 4 &&
+        second.type == CommandType::C_PUSH && second.arg1 == "constant" &&
+        (isArithmetic(commands[pos + 2], "add") || isArithmetic(commands[pos + 2], "sub")) &&
+        commands[pos + 3].type == CommandType::C_POP &&
+        commands[pos + 3].arg1 == first.arg1 && commands[pos + 3].arg2 == first.arg2 &&
+        codeWriter.canUpdateInPlace(first.arg1, first.arg2)) {
+        codeWriter.writeSlotUpdate(first.arg1, first.arg2, commands[pos + 2].arg1, second.arg2);
+        return 4;
+    }
+
+    //push s1 i, pop s2 j
+    if (second.type == CommandType::C_POP) {
+        codeWriter.writeMove(first.arg1, first.arg2, second.arg1, second.arg2);
+        return 2;
+    }
+
+    //push constant c, add|sub|and|or
+    if (first.arg1 == "constant" &&
+        (isArithmetic(second, "add") || isArithmetic(second, "sub") ||
+         isArithmetic(second, "and") || isArithmetic(second, "or"))) {
+        codeWriter.writeConstantArithmetic(second.arg1, first.arg2);
+        return 2;
+    }
+
+    return 0;
+}
+
+size_t Fuser::writeInlineMath(const std::vector<VMCommand>& commands, size_t pos) {
+    /**
+     * Replaces calls to Math.multiply and Math.divide with inline code.
+     *
+     * patterns:
+     * push constant c, call Math.multiply 2            -> shift and add by c
+     * push constant c, push s i, call Math.multiply 2  -> same, operands swapped
+     * call Math.multiply 2                             -> MATH_MULTIPLY routine
+     * call Math.divide 2                               -> MATH_DIVIDE routine
+     *
+     * @param commands the commands of the current file
+     * @param pos the index of the first command of the window
+     * @return the number of commands consumed, 0 if nothing matched
+     */
+    size_t left = commands.size() - pos;
+    const VMCommand& first = commands[pos];
+
+    if (isCall(first, "Math.multiply")) {
+        codeWriter.writeMultiply();
+        return 1;
+    }
+    if (isCall(first, "Math.divide")) {
+        codeWriter.writeDivide();
+        return 1;
+    }
+
+    if (first.type != CommandType::C_PUSH || first.arg1 != "constant" || left < 2) {
+        return 0;
+    }
+
+    //push constant c, call Math.multiply 2
+    if (isCall(commands[pos + 1], "Math.multiply")) {
+        codeWriter.writeConstantMultiply(first.arg2);
+        return 2;
+    }
+
+    //push constant c, push s i, call Math.multiply 2
+    if (left >= 3 && commands[pos + 1].type == CommandType::C_PUSH && isCall(commands[pos + 2], "Math.multiply")) {
+        codeWriter.writePushPop("push", commands[pos + 1].arg1, commands[pos + 1].arg2);
+        codeWriter.writeConstantMultiply(first.arg2);
+        return 3;
+    }
+
+    return 0;
+}
+
+size_t Fuser::writeVoidCalls(const std::vector<VMCommand>& commands, size_t pos) {
+    /**
+     * Leaves out return values nobody uses, see CodeWriter::setVoidFunctions.
+     *
+     * patterns:
+     * call f n, pop temp 0     -> call without popping (f is void)
+     * push constant 0, return  -> return without a value (in a void function)
+     *
+     * @param commands the commands of the current file
+     * @param pos the index of the first command of the window
+     * @return the number of commands consumed, 0 if nothing matched
+     */
+    if (pos + 1 >= commands.size()) {
+        return 0;
+    }
+    const VMCommand& first = commands[pos];
+    const VMCommand& second = commands[pos + 1];
+
+    if (first.type == CommandType::C_CALL && codeWriter.isVoid(first.arg1) &&
+        second.type == CommandType::C_POP && second.arg1 == "temp" && second.arg2 == 0) {
+        codeWriter.writeVoidCall(first.arg1, first.arg2);
+        return 2;
+    }
+    if (first.type == CommandType::C_PUSH && first.arg1 == "constant" && first.arg2 == 0 &&
+        second.type == CommandType::C_RETURN && codeWriter.returnsVoid()) {
+        codeWriter.writeReturn();
+        return 2;
+    }
+    return 0;
+}
+
+size_t Fuser::writeRegisterPush(const std::vector<VMCommand>& commands, size_t pos) {
+    /**
+     * Register allocation for expression temporaries within a basic block, see
+     * CodeWriter::writeRegisterPush. A push keeps the value below it in a
+     * register when a binary command or pop of the same block takes it back
+     * before anything else needs the stack in RAM, and at most three values
+     * are waiting in R13-R15 meanwhile. Otherwise moving it there and back to
+     * RAM costs more than the plain spill.
+     *
+     * ex. push local 0, push local 1, add, pop local 2 -> local 0 waits in R13
+     *
+     * @param commands the commands of the current file
+     * @param pos the index of the push
+     * @return 1 if the push was written, 0 if it was not a push worth a register
+     */
+    if (commands[pos].type != CommandType::C_PUSH) {
+        return 0;
+    }
+
+    int above = 1; //values on top of the one the push moves to a register
+    for (size_t next = pos + 1; next < commands.size() && above <= 3; next++) {
+        const VMCommand& command = commands[next];
+        bool unary = isArithmetic(command, "neg") || isArithmetic(command, "not");
+        if (command.type == CommandType::C_PUSH) {
+            above++;
+        } else if (command.type == CommandType::C_ARITHMETIC && !unary) {
+            if (above == 1) break; //it is the x operand
+            above--;
+        } else if (command.type == CommandType::C_POP) {
+            if (!codeWriter.canUpdateInPlace(command.arg1, command.arg2)) return 0; //the store uses R13 and R14
+            if (above == 1) break; //it becomes the top again
+            above--;
+        } else if (!unary) {
+            return 0; //end of the basic block or a call
+        }
+        if (next + 1 == commands.size()) return 0;
+    }
+    if (above > 3) {
+        return 0;
+    }
+
+    codeWriter.writeRegisterPush(commands[pos].arg1, commands[pos].arg2);
+    return 1;
+}
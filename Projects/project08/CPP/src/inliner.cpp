@@ -0,0 +1,214 @@
+#include "inliner.h"
+#include <sstream>
+#include <algorithm>
+
+//instruction counts of the default translation, used for the report
+const int CALL_COST = 47; //call f n
+const int RETURN_COST = 42; //return
+const int LOCAL_COST = 5; //each local pushed by function f k
+const int POP_SLOT_COST = 5; //pop static i, moves an argument into its slot
+const int INIT_LOCAL_COST = 12; //push constant 0, pop static i
+const int SAVE_POINTER_COST = 24; //push pointer p, pop static i ... push static i, pop pointer p
+
+const int MAX_SLOTS = 8; //arguments, locals and saved pointers of one inlined body
+const int STATIC_LIMIT = 240; //RAM 16..255 holds the statics of every file
+
+Inliner::Inliner(size_t maxSize) : maxSize(maxSize) {}
+
+bool Inliner::findCandidate(const std::vector<VMCommand>& commands, size_t start, size_t file) {
+    /**
+     * Checks the function that starts at commands[start]. It is a candidate if its
+     * body is straight line code without calls, ends in its only return with just
+     * the return value on the stack, does not use temp itself and is small enough.
+     * @return true if the function was recorded as a candidate
+     */
+    InlineCandidate candidate;
+    candidate.file = file;
+    candidate.numLocals = commands[start].arg2;
+    candidate.usesStatic = false;
+    candidate.setsThis = false;
+    candidate.setsThat = false;
+
+    int depth = 0;
+    for (size_t pos = start + 1; pos < commands.size(); pos++) {
+        const VMCommand& command = commands[pos];
+
+        if (command.type == CommandType::C_RETURN) {
+            if (depth != 1 || candidate.body.size() > maxSize) return false;
+            if (candidate.numLocals > MAX_SLOTS) return false;
+            candidate.sites = 0;
+            candidates[commands[start].arg1] = candidate;
+            return true;
+        }
+
+        if (command.type == CommandType::C_PUSH) {
+            depth++;
+        } else if (command.type == CommandType::C_POP) {
+            depth--;
+            if (command.arg1 == "pointer") {
+                (command.arg2 == 0 ? candidate.setsThis : candidate.setsThat) = true;
+            }
+        } else if (command.type == CommandType::C_ARITHMETIC) {
+            if (command.arg1 != "neg" && command.arg1 != "not") depth--;
+        } else {
+            return false; //labels, jumps, calls and the next function
+        }
+
+        if (depth < 0 || command.arg1 == "temp") return false;
+        if (command.arg1 == "static") candidate.usesStatic = true;
+        candidate.body.push_back(command);
+    }
+    return false;
+}
+
+int Inliner::estimateSaving(const InlineCandidate& candidate, int numArgs) const {
+    /**
+     * Instructions saved by one inlined call: the call, the frame setup and the
+     * return, minus moving the arguments into their slots and setting up the locals.
+     */
+    int saved = CALL_COST + RETURN_COST + LOCAL_COST * candidate.numLocals;
+    saved -= POP_SLOT_COST * numArgs + INIT_LOCAL_COST * candidate.numLocals;
+    if (candidate.setsThis) saved -= SAVE_POINTER_COST;
+    if (candidate.setsThat) saved -= SAVE_POINTER_COST;
+    return saved;
+}
+
+int Inliner::slotsNeeded(const InlineCandidate& candidate, int numArgs) {
+    return numArgs + candidate.numLocals + (candidate.setsThis ? 1 : 0) + (candidate.setsThat ? 1 : 0);
+}
+
+bool Inliner::expand(const InlineCandidate& candidate, int numArgs, int base, std::vector<VMCommand>& out) {
+    /**
+     * Appends the body of a candidate in place of call f numArgs.
+     * The arguments are popped into static base..base+n-1 of the calling file and
+     * the locals live in the slots after them. THIS/THAT are saved after those
+     * when the body changes them, a real call would have restored them on return.
+     * temp is not used: the caller may keep values there across the call, and so
+     * may the callers of the function the body is inlined into. The static slots
+     * are past every static the file declares, no other code can see them, and
+     * a body has no calls, so every site of the file can share them.
+     * @return false if an argument is out of range
+     */
+    int saveThis = base + numArgs + candidate.numLocals;
+    int saveThat = saveThis + (candidate.setsThis ? 1 : 0);
+
+    for (int i = numArgs - 1; i >= 0; i--) {
+        out.push_back({CommandType::C_POP, "static", base + i});
+    }
+    if (candidate.setsThis) {
+        out.push_back({CommandType::C_PUSH, "pointer", 0});
+        out.push_back({CommandType::C_POP, "static", saveThis});
+    }
+    if (candidate.setsThat) {
+        out.push_back({CommandType::C_PUSH, "pointer", 1});
+        out.push_back({CommandType::C_POP, "static", saveThat});
+    }
+    for (int i = 0; i < candidate.numLocals; i++) {
+        out.push_back({CommandType::C_PUSH, "constant", 0});
+        out.push_back({CommandType::C_POP, "static", base + numArgs + i});
+    }
+
+    for (VMCommand command : candidate.body) {
+        if (command.arg1 == "argument") {
+            if (command.arg2 >= numArgs) return false;
+            command.arg1 = "static";
+            command.arg2 += base;
+        } else if (command.arg1 == "local") {
+            command.arg1 = "static";
+            command.arg2 += base + numArgs;
+        }
+        out.push_back(command);
+    }
+
+    if (candidate.setsThis) {
+        out.push_back({CommandType::C_PUSH, "static", saveThis});
+        out.push_back({CommandType::C_POP, "pointer", 0});
+    }
+    if (candidate.setsThat) {
+        out.push_back({CommandType::C_PUSH, "static", saveThat});
+        out.push_back({CommandType::C_POP, "pointer", 1});
+    }
+    return true;
+}
+
+void Inliner::inlineCalls(std::vector<VMFile>& program) {
+    /**
+     * Replaces calls to small leaf functions with their bodies, across the whole
+     * program. The functions themselves are kept, they may still be called from
+     * places that could not be inlined. Runs a single pass, so functions that only
+     * become leaves after inlining are left alone.
+     * @param program every file of the program, changed in place
+     */
+    candidates.clear();
+    for (size_t file = 0; file < program.size(); file++) {
+        const std::vector<VMCommand>& commands = program[file].commands;
+        for (size_t pos = 0; pos < commands.size(); pos++) {
+            if (commands[pos].type == CommandType::C_FUNCTION) {
+                findCandidate(commands, pos, file);
+            }
+        }
+    }
+
+    //statics declared by each file, the scratch slots go after them
+    std::vector<int> statics(program.size(), 0);
+    int totalStatics = 0;
+    for (size_t file = 0; file < program.size(); file++) {
+        for (const auto& command : program[file].commands) {
+            if ((command.type == CommandType::C_PUSH || command.type == CommandType::C_POP) && command.arg1 == "static") {
+                statics[file] = std::max(statics[file], command.arg2 + 1);
+            }
+        }
+        totalStatics += statics[file];
+    }
+
+    for (size_t file = 0; file < program.size(); file++) {
+        std::vector<VMCommand> out;
+        int scratch = 0; //slots after the file's statics used so far
+        for (const auto& command : program[file].commands) {
+            auto candidate = candidates.find(command.arg1);
+            if (command.type == CommandType::C_CALL && candidate != candidates.end() &&
+                (!candidate->second.usesStatic || candidate->second.file == file)) {
+                int slots = slotsNeeded(candidate->second, command.arg2);
+                int growth = std::max(0, slots - scratch);
+                if (slots > MAX_SLOTS || totalStatics + growth > STATIC_LIMIT) {
+                    out.push_back(command); //no room, keep the call
+                    continue;
+                }
+                size_t mark = out.size();
+                if (expand(candidate->second, command.arg2, statics[file], out)) {
+                    scratch += growth;
+                    totalStatics += growth;
+                    candidate->second.sites++;
+                    candidate->second.cyclesSaved += estimateSaving(candidate->second, command.arg2);
+                    continue;
+                }
+                out.resize(mark); //argument out of range, keep the call
+            }
+            out.push_back(command);
+        }
+        program[file].commands = out;
+    }
+}
+
+std::string Inliner::report() const {
+    /**
+     * One line per inlined function and a total, cycles are estimated per
+     * execution of every replaced call site.
+     */
+    std::ostringstream report;
+    int functions = 0;
+    int sites = 0;
+    int saved = 0;
+    for (const auto& entry : candidates) {
+        const InlineCandidate& candidate = entry.second;
+        if (candidate.sites == 0) continue;
+        report << "  " << entry.first << ": " << candidate.body.size() << " commands, "
+               << candidate.sites << " call sites, ~" << candidate.cyclesSaved << " cycles saved\n";
+        functions++;
+        sites += candidate.sites;
+        saved += candidate.cyclesSaved;
+    }
+    report << "Inlined " << functions << " functions at " << sites << " call sites, ~"
+           << saved << " cycles saved per pass over them";
+    return report.str();
+}
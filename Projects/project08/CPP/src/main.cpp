@@ -2,33 +2,198 @@
 #include <string>
 #include <vector>
 #include <filesystem>
+#include <fstream>
+#include <cctype>
+#include <sstream>
+#include <tuple>
+#include <iterator>
+#include <memory>
 #include "vmtranslator.h"
 #include "codewriter.h"
 #include "vmparser.h"
+#include "fuser.h"
+#include "vmoptimizer.h"
+#include "callgraph.h"
+#include "inliner.h"
+#include "folder.h"
+#include "vmbinary.h"
+#include "cache.h"
+#include "report.h"
 
 void showHelp(const char* programName) {
     std::cout << std::endl;
-    std::cout << "Usage: " << programName << " [OPTIONS] [FILE|DIRECTORY]" << std::endl;
+    std::cout << "Usage: " << programName << " [OPTIONS] [FILE|DIRECTORY|-]" << std::endl;
     std::cout << std::endl;
     std::cout << "OPTIONS:" << std::endl;
-    std::cout << " -f, --file FILE/DIR | Specify input .vm file or directory" << std::endl;
+    std::cout << " -f, --file FILE/DIR | Specify input .vm/.vmb file or directory" << std::endl;
+    std::cout << " -o, --output FILE   | Write the assembly to FILE, - for stdout (default for stdin)" << std::endl;
     std::cout << " -v, --verbose       | Enable Verbose Output" << std::endl;
+    std::cout << " -t, --tos           | Cache the top of stack in the D register" << std::endl;
+    std::cout << " --registers         | Keep expression temporaries in R13-R15 (implies --tos)" << std::endl;
+    std::cout << " --batch-sp          | Update SP once per straight line run of pushes and pops" << std::endl;
+    std::cout << " --fuse              | Emit fused code for common command sequences" << std::endl;
+    std::cout << " -O, --optimize      | Optimize the VM commands before translating them" << std::endl;
+    std::cout << " --layout            | Reorder basic blocks so loops and hot paths fall through" << std::endl;
+    std::cout << " --layout-profile F  | Use label counts from F for --layout (implies --layout)" << std::endl;
+    std::cout << " --emit-vm DIR       | Write the optimized .vm files to DIR" << std::endl;
+    std::cout << " --inline            | Inline small leaf functions and report the savings" << std::endl;
+    std::cout << " --fold              | Keep one copy of identical functions and report the words saved" << std::endl;
+    std::cout << " --inline-math       | Inline Math.multiply and Math.divide calls" << std::endl;
+    std::cout << " --no-native-os      | Call the compiled Math/Memory functions, not the native ones" << std::endl;
+    std::cout << " --tail-calls        | Reuse the current frame for a call followed by return" << std::endl;
+    std::cout << " --light-calls       | Skip saving THIS/THAT for callees that never change them" << std::endl;
+    std::cout << " --void-calls        | Return nothing from functions whose 0 result is always popped to temp 0" << std::endl;
+    std::cout << " --static-frames     | Give non recursive functions fixed frames below RAM[2048], up to 512 words off the stack" << std::endl;
+    std::cout << " --profile           | Count calls per function in RAM below 2048 (2 words each, 3 with a clock), writes a .prof map" << std::endl;
+    std::cout << " --profile-clock A   | Also accumulate clock RAM[A] between entry and exit (implies --profile)" << std::endl;
+    std::cout << " --cache DIR         | Reuse the code of unchanged files from DIR (not with whole program options)" << std::endl;
+    std::cout << " --source-map        | Mark each command's VM and Jack line in the .asm for the assembler" << std::endl;
+    std::cout << " --report FILE       | Write ROM words and static cycle estimates per opcode and function as JSON" << std::endl;
     std::cout << " -h, --help          | Show this help message" << std::endl;
     std::cout << std::endl;
     std::cout << " Files/directories can also be provided as positional arguments" << std::endl;
+    std::cout << " - reads a whole program from stdin, always with bootstrap code. Without whole" << std::endl;
+    std::cout << " program options each function is written out as soon as the next one starts" << std::endl;
 }
 
+void writeProfileMap(const std::string& mapFile, const std::map<std::string, int>& slots, int clock) {
+    /**
+     * Writes the sidecar map for --profile: one "address function" line per
+     * function, so a RAM dump of the program can be turned into a profile.
+     */
+    std::ofstream map(mapFile);
+    if (!map.is_open()) {
+        throw std::runtime_error("Could not open profile map: " + mapFile);
+    }
+    map << "//calls = RAM[address] + 65536 * RAM[address+1]" << std::endl;
+    if (clock >= 0) {
+        map << "//ticks = RAM[address+2], sum of RAM[" << clock << "] at exit - at entry (16 bit)" << std::endl;
+    }
+    for (const auto& slot : slots) {
+        map << slot.second << " " << slot.first << std::endl;
+    }
+}
+
+std::vector<VMFile> splitByClass(const std::vector<VMCommand>& commands) {
+    /**
+     * Splits a program read from stdin into one file per class, the class is
+     * the part of the function name before the dot. static belongs to the
+     * file, so this keeps Main.vm and Math.vm statics apart as in directory mode.
+     * Commands before the first function go to stdin.vm.
+     */
+    std::vector<VMFile> files;
+    std::map<std::string, size_t> fileOf;
+    size_t current = 0;
+    for (const auto& command : commands) {
+        if (command.type == CommandType::C_FUNCTION || files.empty()) {
+            std::string name = command.type == CommandType::C_FUNCTION ? command.arg1.substr(0, command.arg1.find('.')) : "stdin";
+            auto it = fileOf.emplace(name, files.size()).first;
+            if (it->second == files.size()) files.push_back({name + ".vm", {}});
+            current = it->second;
+        }
+        files[current].commands.push_back(command);
+    }
+    return files;
+}
+
+void writeCommand(CodeWriter& codeWriter, const VMCommand& command, int lineNum, const std::string& vmFile, bool verbose) {
+    CommandType type = command.type;
+
+    if (type == CommandType::C_ARITHMETIC) {
+        if (verbose) {
+            std::cout << "  Line " << lineNum << ": " << command.arg1 << std::endl;
+        }
+        codeWriter.writeArithmetic(command.arg1);
+    }
+    else if (type == CommandType::C_PUSH) {
+        if (verbose) {
+            std::cout << "  Line " << lineNum << ": push " << command.arg1 << " " << command.arg2 << std::endl;
+        }
+        codeWriter.writePushPop("push", command.arg1, command.arg2);
+    }
+    else if (type == CommandType::C_POP) {
+        if (verbose) {
+            std::cout << "  Line " << lineNum << ": pop " << command.arg1 << " " << command.arg2 << std::endl;
+        }
+        codeWriter.writePushPop("pop", command.arg1, command.arg2);
+    }
+    else if (type == CommandType::C_LABEL) {
+        if (verbose) {
+            std::cout << "  Line " << lineNum << ": label " << command.arg1 << std::endl;
+        }
+        codeWriter.writeLabel(command.arg1);
+    }
+    else if (type == CommandType::C_GOTO) {
+        if (verbose) {
+            std::cout << "  Line " << lineNum << ": goto " << command.arg1 << std::endl;
+        }
+        codeWriter.writeGoto(command.arg1);
+    }
+    else if (type == CommandType::C_IF) {
+        if (verbose) {
+            std::cout << "  Line " << lineNum << ": if-goto " << command.arg1 << std::endl;
+        }
+        codeWriter.writeIf(command.arg1);
+    }
+    else if (type == CommandType::C_FUNCTION) {
+        if (verbose) {
+            std::cout << "  Line " << lineNum << ": function " << command.arg1 << " " << command.arg2 << std::endl;
+        }
+        codeWriter.writeFunction(command.arg1, command.arg2);
+    }
+    else if (type == CommandType::C_CALL) {
+        if (verbose) {
+            std::cout << "  Line " << lineNum << ": call " << command.arg1 << " " << command.arg2 << std::endl;
+        }
+        codeWriter.writeCall(command.arg1, command.arg2);
+    }
+    else if (type == CommandType::C_RETURN) {
+        if (verbose) {
+            std::cout << "  Line " << lineNum << ": return" << std::endl;
+        }
+        codeWriter.writeReturn();
+    }
+    else {
+        throw std::runtime_error("Unknown command type at line " + std::to_string(lineNum) + " in file " + vmFile);
+    }
+}
+
+const int STACK_FLOOR = 1280; //--profile and --static-frames leave the stack at least 1024 words
+const int FRAME_BUDGET = 512; //most words --static-frames takes
+
 int main(int argc, const char* const argv[]) {
     bool verbose = false;
+    bool cacheTop = false;
+    bool registers = false;
+    bool fuse = false;
+    bool batchSP = false;
+    bool optimize = false;
+    std::string emitVMDir;
+    bool layout = false;
+    std::string profileFile;
+    bool staticFrames = false;
+    bool tailCalls = false;
+    bool inlineMath = false;
+    bool nativeOS = true;
+    bool inlineLeaves = false;
+    bool fold = false;
+    bool lightCalls = false;
+    bool voidCalls = false;
+    bool profileCalls = false;
+    bool sourceMap = false;
+    std::string cacheDir;
+    std::string reportFile;
+    int profileClock = -1;
     bool showHelpFlag = false;
     std::string inputPath;
+    std::string outputPath;
     
     //parse command line arguments
     for (int i = 1; i < argc; i++) {
         std::string arg = argv[i];
         
         if (arg == "-f" || arg == "--file") {
-            if (i + 1 < argc && argv[i + 1][0] != '-') {
+            if (i + 1 < argc && (argv[i + 1][0] != '-' || std::string(argv[i + 1]) == "-")) {
                 inputPath = argv[++i];
             } else {
                 std::cerr << "ERROR: -f/--file requires a file argument" << std::endl;
@@ -36,14 +201,91 @@ int main(int argc, const char* const argv[]) {
             }
         } else if (arg.substr(0, 7) == "--file=") {
             inputPath = arg.substr(7);
+        } else if (arg == "-o" || arg == "--output") {
+            if (i + 1 < argc) {
+                outputPath = argv[++i];
+            } else {
+                std::cerr << "ERROR: -o/--output requires a file argument" << std::endl;
+                return 1;
+            }
         } else if (arg == "-v" || arg == "--verbose") {
             verbose = true;
+        } else if (arg == "-t" || arg == "--tos") {
+            cacheTop = true;
+        } else if (arg == "--registers") {
+            cacheTop = true;
+            registers = true;
+        } else if (arg == "--batch-sp") {
+            batchSP = true;
+        } else if (arg == "--fuse") {
+            fuse = true;
+        } else if (arg == "-O" || arg == "--optimize") {
+            optimize = true;
+        } else if (arg == "--layout") {
+            layout = true;
+        } else if (arg == "--layout-profile") {
+            if (i + 1 < argc) {
+                profileFile = argv[++i];
+                layout = true;
+            } else {
+                std::cerr << "ERROR: --layout-profile requires a file argument" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--emit-vm") {
+            if (i + 1 < argc) {
+                emitVMDir = argv[++i];
+            } else {
+                std::cerr << "ERROR: --emit-vm requires a directory argument" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--inline") {
+            inlineLeaves = true;
+        } else if (arg == "--fold") {
+            fold = true;
+        } else if (arg == "--inline-math") {
+            inlineMath = true;
+        } else if (arg == "--no-native-os") {
+            nativeOS = false; //ex. to test an OS of your own
+        } else if (arg == "--tail-calls") {
+            tailCalls = true;
+        } else if (arg == "--light-calls") {
+            lightCalls = true;
+        } else if (arg == "--void-calls") {
+            voidCalls = true;
+        } else if (arg == "--static-frames") {
+            staticFrames = true;
+        } else if (arg == "--profile") {
+            profileCalls = true;
+        } else if (arg == "--profile-clock") {
+            if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                profileClock = std::stoi(argv[++i]);
+                profileCalls = true;
+            } else {
+                std::cerr << "ERROR: --profile-clock requires a RAM address" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--cache") {
+            if (i + 1 < argc) {
+                cacheDir = argv[++i];
+            } else {
+                std::cerr << "ERROR: --cache requires a directory argument" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--source-map") {
+            sourceMap = true;
+        } else if (arg == "--report") {
+            if (i + 1 < argc) {
+                reportFile = argv[++i];
+            } else {
+                std::cerr << "ERROR: --report requires a file argument" << std::endl;
+                return 1;
+            }
         } else if (arg == "-h" || arg == "--help") {
             showHelpFlag = true;
         } else if (arg == "-n" || arg == "-y") {
             //ignore -n and -y options for compatibility with autograder
             continue;
-        } else if (arg[0] == '-') {
+        } else if (arg[0] == '-' && arg != "-") {
             std::cerr << "ERROR: Unknown option " << arg << std::endl;
             showHelp(argv[0]);
             return 1;
@@ -70,7 +312,8 @@ int main(int argc, const char* const argv[]) {
     }
 
     //check if path exists
-    if (!std::filesystem::exists(inputPath)) {
+    bool fromStdin = inputPath == "-";
+    if (!fromStdin && !std::filesystem::exists(inputPath)) {
         std::cerr << "ERROR: Path '" << inputPath << "' does not exist" << std::endl;
         return 1;
     }
@@ -78,12 +321,17 @@ int main(int argc, const char* const argv[]) {
     std::vector<std::string> vmFiles;
     std::string outputFile;
     
-    //handle directory or single file
-    if (std::filesystem::is_directory(inputPath)) {
-        //directory: collect all .vm files
+    //handle stdin, directory or single file
+    if (fromStdin) {
+        vmFiles.push_back(inputPath);
+        outputFile = "-";
+    } else if (std::filesystem::is_directory(inputPath)) {
+        //directory: collect all .vm and .vmb files, the binary one wins if a file has both
         for (const auto& entry : std::filesystem::directory_iterator(inputPath)) {
-            if (entry.path().extension() == ".vm") {
-                vmFiles.push_back(entry.path().string());
+            std::filesystem::path path = entry.path();
+            if (path.extension() == ".vmb" ||
+                (path.extension() == ".vm" && !std::filesystem::exists(std::filesystem::path(path).replace_extension(".vmb")))) {
+                vmFiles.push_back(path.string());
             }
         }
         
@@ -105,8 +353,9 @@ int main(int argc, const char* const argv[]) {
         }
     } else {
         //single file mode
-        if (std::filesystem::path(inputPath).extension() != ".vm") {
-            std::cerr << "ERROR: Input file must have .vm extension" << std::endl;
+        std::string extension = std::filesystem::path(inputPath).extension().string();
+        if (extension != ".vm" && extension != ".vmb") {
+            std::cerr << "ERROR: Input file must have .vm or .vmb extension" << std::endl;
             return 1;
         }
         
@@ -114,23 +363,177 @@ int main(int argc, const char* const argv[]) {
         
         //create output file name (.asm)
         std::filesystem::path p(inputPath);
-        std::string outputFile = p.replace_extension(".asm").string();
+        outputFile = p.replace_extension(".asm").string();
     }
     
+    if (!outputPath.empty()) {
+        outputFile = outputPath;
+    }
+    bool toStdout = outputFile == "-";
+    if (toStdout && profileCalls) {
+        std::cerr << "ERROR: --profile writes a map next to the output file, it needs -o FILE" << std::endl;
+        return 1;
+    }
+
     if (verbose) {
-        std::cerr << "Translating to " << outputFile << std::endl;
+        std::cerr << "Translating to " << (toStdout ? "stdout" : outputFile) << std::endl;
+    }
+
+    //the assembly owns stdout, messages and reports go to stderr instead
+    std::streambuf* standardOutput = std::cout.rdbuf();
+    if (toStdout) {
+        std::cout.rdbuf(std::cerr.rdbuf());
     }
     
     try {
         //create CodeWriter
-        CodeWriter codeWriter(outputFile);
+        std::unique_ptr<CodeWriter> writer = toStdout ? std::make_unique<CodeWriter>(standardOutput) : std::make_unique<CodeWriter>(outputFile);
+        CodeWriter& codeWriter = *writer;
+        codeWriter.setCacheTop(cacheTop);
+        codeWriter.setBatchSP(batchSP);
+        codeWriter.setSourceMap(sourceMap);
+        codeWriter.setNativeOS(nativeOS);
+        CodeReport report;
+        if (!reportFile.empty()) {
+            codeWriter.countInstructions();
+        }
+        Fuser fuser(codeWriter);
+        Optimizer optimizer(verbose);
+
+        if (!emitVMDir.empty()) {
+            std::filesystem::create_directories(emitVMDir);
+        }
+
+        std::map<std::string, long> profile;
+        if (!profileFile.empty()) {
+            profile = Optimizer::readProfile(profileFile);
+        }
+
+        //the cache works file by file, options that look at the whole program turn it off
+        bool wholeProgram = inlineLeaves || fold || staticFrames || lightCalls || voidCalls || profileCalls || !emitVMDir.empty();
+        bool useCache = !cacheDir.empty() && !wholeProgram && !fromStdin && !toStdout && reportFile.empty();
+        if (!cacheDir.empty() && wholeProgram) {
+            std::cerr << "WARNING: --cache is ignored with --inline, --fold, --static-frames, --light-calls, --void-calls, --profile and --emit-vm" << std::endl;
+        } else if (!cacheDir.empty() && !reportFile.empty()) {
+            std::cerr << "WARNING: --cache is ignored with --report, the report counts every command as it is translated" << std::endl;
+        } else if (!cacheDir.empty() && !useCache) {
+            std::cerr << "WARNING: --cache needs files, it is ignored for stdin and stdout" << std::endl;
+        }
+        bool streaming = fromStdin && !wholeProgram; //translate each function as it arrives
+        std::ostringstream options;
+        options << cacheTop << registers << batchSP << fuse << optimize << layout << inlineMath << tailCalls << sourceMap << nativeOS;
+        for (const auto& count : profile) options << " " << count.first << "=" << count.second;
+        TranslationCache cache(cacheDir, options.str());
+        codeWriter.setFileLabels(useCache);
+
+        //parse every file first, inlining and static frames need the whole program
+        std::vector<VMFile> program;
+        std::map<std::string, std::string> cached; //file -> code reused from the cache
+        std::map<std::string, std::string> cacheKeys; //file -> key, for files translated now
+        for (const auto& vmFile : vmFiles) {
+            if (vmFile == "-") {
+                if (!streaming) {
+                    Parser parser(std::cin, "stdin");
+                    program = splitByClass(parser.readAll());
+                }
+                continue;
+            }
+            if (useCache) {
+                std::string key = cache.key(vmFile);
+                std::string code;
+                if (cache.lookup(key, code)) {
+                    cached[vmFile] = code;
+                    program.push_back({vmFile, {}});
+                    continue;
+                }
+                cacheKeys[vmFile] = key;
+            }
+            if (std::filesystem::path(vmFile).extension() == ".vmb") {
+                program.push_back({vmFile, readBinaryVM(vmFile)});
+                continue;
+            }
+            Parser parser(vmFile);
+            program.push_back({vmFile, parser.readAll()});
+        }
+
+        if (inlineLeaves) {
+            Inliner inliner;
+            inliner.inlineCalls(program);
+            std::cout << inliner.report() << std::endl;
+        }
+
+        for (auto& file : program) {
+            if (optimize) {
+                file.commands = optimizer.optimize(file.commands);
+            }
+            if (layout) {
+                file.commands = optimizer.layout(file.commands, profile);
+            }
+        }
+
+        FunctionFolder folder;
+        if (fold) {
+            folder.fold(program);
+        }
+
+        for (const auto& file : program) {
+            if (!emitVMDir.empty()) {
+                std::string vmName = std::filesystem::path(file.path).filename().string();
+                Optimizer::writeVM((std::filesystem::path(emitVMDir) / vmName).string(), file.commands);
+            }
+        }
+
+        CallGraph callGraph(program);
+        if (lightCalls) {
+            std::set<std::string> light = callGraph.findLightFunctions();
+            codeWriter.setLightFunctions(light);
+            if (verbose) {
+                std::cerr << "Light calls: " << light.size() << " of " << callGraph.getFunctions().size() << " functions" << std::endl;
+            }
+        }
+
+        if (voidCalls) {
+            std::set<std::string> found = callGraph.findVoidFunctions();
+            codeWriter.setVoidFunctions(found);
+            if (verbose) {
+                std::cerr << "Void calls: " << found.size() << " of " << callGraph.getFunctions().size() << " functions" << std::endl;
+            }
+        }
+
+        //profile counters take the top of the stack region, static frames go below them,
+        //together they leave the stack at least RAM[256..STACK_FLOOR - 1]
+        int reservedTop = 2048;
+        std::map<std::string, int> profileSlots;
+        if (profileCalls) {
+            profileSlots = callGraph.allocateProfileSlots(reservedTop, STACK_FLOOR, profileClock >= 0 ? 3 : 2);
+            codeWriter.setProfile(profileSlots, profileClock);
+            for (const auto& slot : profileSlots) reservedTop = std::min(reservedTop, slot.second);
+            if (verbose) {
+                std::cerr << "Profile: " << profileSlots.size() << " functions, RAM[" << reservedTop << "..2047]" << std::endl;
+            }
+        }
+
+        if (staticFrames) {
+            int room = std::min(FRAME_BUDGET, reservedTop - STACK_FLOOR);
+            if (room <= 0) {
+                throw std::runtime_error("--static-frames: no RAM left for frames, the profile counters take RAM[" +
+                                         std::to_string(reservedTop) + "..2047]");
+            }
+            std::map<std::string, StaticFrame> frames = callGraph.allocateStaticFrames(reservedTop, room);
+            codeWriter.setStaticFrames(frames);
+            if (verbose) {
+                int lowest = reservedTop;
+                for (const auto& frame : frames) lowest = std::min(lowest, frame.second.base);
+                std::cerr << "Static frames: " << frames.size() << " functions, RAM[" << lowest << ".." << reservedTop - 1 << "]" << std::endl;
+            }
+        }
         
         //write bootstrap code (for directory mode or if Sys.vm exists)
         bool needsBootstrap = vmFiles.size() > 1;
         if (!needsBootstrap) {
             //check if single file is Sys.vm or contains Sys.init
-            std::string fileName = std::filesystem::path(vmFiles[0]).filename().string();
-            if (fileName == "Sys.vm") {
+            std::string fileName = std::filesystem::path(vmFiles[0]).stem().string();
+            if (fileName == "Sys" || fromStdin) {
                 needsBootstrap = true;
             }
         }
@@ -141,103 +544,152 @@ int main(int argc, const char* const argv[]) {
             }
             codeWriter.writeInit();
         }
+        report.setBootstrap(codeWriter.instructionCount());
         
         //translate each .vm file
-        for (const auto& vmFile : vmFiles) {
+        std::vector<std::tuple<std::string, std::streampos, std::streampos>> newEntries; //cache key, code range in the output
+        auto translateFile = [&](const VMFile& file) {
+            const std::string& vmFile = file.path;
+            const std::vector<VMCommand>& commands = file.commands;
             if (verbose) {
                 std::cerr << "Translating " << vmFile << "..." << std::endl;
             }
             
-            Parser parser(vmFile);
             codeWriter.setFileName(vmFile);
-            
-            int lineNum = 0;
-            while (parser.hasMoreCommands()) {
-                parser.advance();
-                lineNum++;
 
-                CommandType type = parser.commandType();
+            auto hit = cached.find(vmFile);
+            if (hit != cached.end()) {
+                codeWriter.writeCached(hit->second);
+                return;
+            }
+            std::streampos start = codeWriter.filePosition();
 
-                if (type == CommandType::C_ARITHMETIC) {
-                    std::string command = parser.arg1();
-                    if (verbose) {
-                        std::cout << "  Line " << lineNum << ": " << command << std::endl;
-                    }
-                    codeWriter.writeArithmetic(command);
-                } 
-                else if (type == CommandType::C_PUSH) {
-                    std::string segment = parser.arg1();
-                    int index = parser.arg2();
-                    if (verbose) {
-                        std::cout << "  Line " << lineNum << ": push " << segment << " " << index << std::endl;
-                    }
-                    codeWriter.writePushPop("push", segment, index);
-                } 
-                else if (type == CommandType::C_POP) {
-                    std::string segment = parser.arg1();
-                    int index = parser.arg2();
-                    if (verbose) {
-                        std::cout << "  Line " << lineNum << ": pop " << segment << " " << index << std::endl;
-                    }
-                    codeWriter.writePushPop("pop", segment, index);
+            size_t pos = 0;
+            while (pos < commands.size()) {
+                if (!commands[pos].source.empty()) {
+                    codeWriter.writeMarker(commands[pos].source + " " + formatCommand(commands[pos]));
                 }
-                else if (type == CommandType::C_LABEL) {
-                    std::string label = parser.arg1();
-                    if (verbose) {
-                        std::cout << "  Line " << lineNum << ": label " << label << std::endl;
-                    }
-                    codeWriter.writeLabel(label);
+                long before = codeWriter.instructionCount();
+                std::string kind; //how the report counts the commands, empty for one command under its opcode
+                size_t used = voidCalls ? fuser.writeVoidCalls(commands, pos) : 0;
+                if (used > 0) {
+                    kind = commands[pos].type == CommandType::C_CALL ? "void call" : "void return";
+                } else if (inlineMath && (used = fuser.writeInlineMath(commands, pos)) > 0) {
+                    kind = "inline math";
+                } else if (fuse && (used = fuser.writeFused(commands, pos)) > 0) {
+                    kind = "fused";
                 }
-                else if (type == CommandType::C_GOTO) {
-                    std::string label = parser.arg1();
+                if (used > 0) {
                     if (verbose) {
-                        std::cout << "  Line " << lineNum << ": goto " << label << std::endl;
+                        std::cout << "  Lines " << (pos + 1) << "-" << (pos + used) << ": fused" << std::endl;
                     }
-                    codeWriter.writeGoto(label);
-                }
-                else if (type == CommandType::C_IF) {
-                    std::string label = parser.arg1();
+                } else if (registers && (used = fuser.writeRegisterPush(commands, pos)) > 0) { //counted under its opcode
                     if (verbose) {
-                        std::cout << "  Line " << lineNum << ": if-goto " << label << std::endl;
+                        std::cout << "  Line " << (pos + 1) << ": push " << commands[pos].arg1 << " " << commands[pos].arg2 << " (register)" << std::endl;
                     }
-                    codeWriter.writeIf(label);
-                }
-                else if (type == CommandType::C_FUNCTION) {
-                    std::string functionName = parser.arg1();
-                    int numLocals = parser.arg2();
+                } else if (tailCalls && commands[pos].type == CommandType::C_CALL &&
+                    pos + 1 < commands.size() && commands[pos + 1].type == CommandType::C_RETURN) {
                     if (verbose) {
-                        std::cout << "  Line " << lineNum << ": function " << functionName << " " << numLocals << std::endl;
+                        std::cout << "  Lines " << (pos + 1) << "-" << (pos + 2) << ": tail call " << commands[pos].arg1 << std::endl;
                     }
-                    codeWriter.writeFunction(functionName, numLocals);
-                }
-                else if (type == CommandType::C_CALL) {
-                    std::string functionName = parser.arg1();
-                    int numArgs = parser.arg2();
-                    if (verbose) {
-                        std::cout << "  Line " << lineNum << ": call " << functionName << " " << numArgs << std::endl;
+                    codeWriter.writeTailCall(commands[pos].arg1, commands[pos].arg2);
+                    used = 2;
+                    kind = "tail call";
+                } else {
+                    if (commands[pos].type == CommandType::C_CALL && codeWriter.hasNative(commands[pos].arg1, commands[pos].arg2)) {
+                        kind = "native call";
                     }
-                    codeWriter.writeCall(functionName, numArgs);
+                    writeCommand(codeWriter, commands[pos], static_cast<int>(pos + 1), vmFile, verbose);
+                    used = 1;
                 }
-                else if (type == CommandType::C_RETURN) {
-                    if (verbose) {
-                        std::cout << "  Line " << lineNum << ": return" << std::endl;
-                    }
-                    codeWriter.writeReturn();
+
+                if (!reportFile.empty()) {
+                    report.add(commands, pos, used, codeWriter.instructionCount() - before, kind);
+                }
+                pos += used;
+            }
+
+            if (useCache) {
+                newEntries.emplace_back(cacheKeys[vmFile], start, codeWriter.filePosition());
+            }
+        };
+
+        if (streaming) {
+            //a function is complete when the next one starts, or at the end of the input
+            Parser parser(std::cin, "stdin");
+            VMFile function{"stdin.vm", {}};
+            auto translateFunction = [&]() {
+                if (optimize) {
+                    function.commands = optimizer.optimize(function.commands);
                 }
-                else {
-                    throw std::runtime_error("Unknown command type at line " + std::to_string(lineNum) + " in file " + vmFile);
+                if (layout) {
+                    function.commands = optimizer.layout(function.commands, profile);
+                }
+                translateFile(function);
+                codeWriter.flush();
+                function.commands.clear();
+            };
+            while (parser.hasMoreCommands()) {
+                parser.advance();
+                VMCommand command = parser.command();
+                if (command.type == CommandType::C_FUNCTION) {
+                    if (!function.commands.empty()) translateFunction();
+                    function.path = command.arg1.substr(0, command.arg1.find('.')) + ".vm";
                 }
+                function.commands.push_back(command);
+            }
+            if (!function.commands.empty()) translateFunction();
+        } else {
+            for (const auto& file : program) {
+                translateFile(file);
             }
         }
         
+        if ((optimize || layout) && verbose) {
+            std::cerr << "Optimizer: " << optimizer.summary() << std::endl;
+        }
+
+        long translated = codeWriter.instructionCount();
         codeWriter.close();
+
+        if (!reportFile.empty()) {
+            report.setTotal(codeWriter.instructionCount(), codeWriter.instructionCount() - translated);
+            report.write(reportFile);
+            std::cout << "Report written to " << reportFile << std::endl;
+        }
+
+        if (useCache) {
+            std::ifstream written(outputFile, std::ios::binary);
+            std::string code((std::istreambuf_iterator<char>(written)), std::istreambuf_iterator<char>());
+            for (const auto& entry : newEntries) {
+                std::streamoff start = std::get<1>(entry);
+                std::streamoff end = std::get<2>(entry);
+                cache.store(std::get<0>(entry), code.substr(start, end - start));
+            }
+            std::cout << cache.summary() << std::endl;
+        }
+
+        if (profileCalls) {
+            std::string mapFile = std::filesystem::path(outputFile).replace_extension(".prof").string();
+            writeProfileMap(mapFile, profileSlots, profileClock);
+            std::cout << "Profile map written to " << mapFile << std::endl;
+        }
+
+        if (fold) {
+            //the words per function are counted in the output file, there is none on stdout
+            std::map<std::string, int> words;
+            if (!toStdout) words = FunctionFolder::countWords(outputFile, program);
+            std::cout << folder.report(words) << std::endl;
+        }
         
-        std::cout << "Successfully translated to " << outputFile << std::endl;
+        std::cout << "Successfully translated to " << (toStdout ? "stdout" : outputFile) << std::endl;
         
     } catch (const std::exception& e) {
+        std::cout.rdbuf(standardOutput);
         std::cerr << "ERROR: " << e.what() << std::endl;
         return 1;
     }
+    std::cout.rdbuf(standardOutput);
     
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,141 @@
+#include "nativeos.h"
+
+const std::map<std::string, NativeRoutine>& nativeRoutines() {
+    /**
+     * Only OS functions whose result depends on nothing but their arguments
+     * and RAM are here. Memory.alloc, Screen and Output keep state in statics
+     * of the compiled OS (free list, color, cursor, font), so they stay compiled.
+     * Comparisons subtract like the VM's lt/gt, so overflow behaves the same.
+     * Math.multiply and Math.divide use the MATH_ routines of --inline-math.
+     */
+    static const std::map<std::string, NativeRoutine> routines = {
+        {"Math.abs", {1, "", false,
+            "@SP\n"
+            "A=M-1\n"
+            "D=M\n"
+            "@$END\n"
+            "D;JGE\n"
+            "@SP\n"
+            "A=M-1\n"
+            "M=-D\n"
+            "($END)\n"}},
+        {"Math.min", {2, "", false,
+            "@SP\n"
+            "AM=M-1\n"
+            "D=M\n"
+            "A=A-1\n"
+            "D=M-D\n" //x - y
+            "@$END\n"
+            "D;JLT\n" //keep x
+            "@SP\n"
+            "A=M\n"
+            "D=M\n"
+            "A=A-1\n"
+            "M=D\n"
+            "($END)\n"}},
+        {"Math.max", {2, "", false,
+            "@SP\n"
+            "AM=M-1\n"
+            "D=M\n"
+            "A=A-1\n"
+            "D=M-D\n" //x - y
+            "@$END\n"
+            "D;JGT\n" //keep x
+            "@SP\n"
+            "A=M\n"
+            "D=M\n"
+            "A=A-1\n"
+            "M=D\n"
+            "($END)\n"}},
+        {"Memory.peek", {1, "", false,
+            "@SP\n"
+            "A=M-1\n"
+            "A=M\n"
+            "D=M\n"
+            "@SP\n"
+            "A=M-1\n"
+            "M=D\n"}},
+        {"Memory.poke", {2, "", false,
+            "@SP\n"
+            "AM=M-1\n"
+            "D=M\n" //value
+            "A=A-1\n"
+            "A=M\n"
+            "M=D\n"
+            "@SP\n"
+            "A=M-1\n"
+            "M=0\n"}}, //void functions return 0
+        //digit by digit square root: two bits of x into the remainder per
+        //step, R13 = x, R14 = remainder, RAM[SP] = root, RAM[SP+1] = steps left
+        {"Math.sqrt", {1, "JLT", true,
+            "@SP\n"
+            "A=M-1\n"
+            "D=M\n"
+            "@R13\n"
+            "M=D\n"
+            "@R14\n"
+            "M=0\n"
+            "@SP\n"
+            "A=M\n"
+            "M=0\n"
+            "@8\n"
+            "D=A\n"
+            "@SP\n"
+            "A=M+1\n"
+            "M=D\n"
+            "($LOOP)\n"
+            "@R14\n"
+            "D=M\n"
+            "M=D+M\n"
+            "@R13\n"
+            "D=M\n"
+            "M=D+M\n" //shift the top bit out of x
+            "@$LOW\n"
+            "D;JGE\n"
+            "@R14\n"
+            "M=M+1\n" //into the remainder
+            "($LOW)\n"
+            "@R14\n"
+            "D=M\n"
+            "M=D+M\n"
+            "@R13\n"
+            "D=M\n"
+            "M=D+M\n"
+            "@$TRIAL\n"
+            "D;JGE\n"
+            "@R14\n"
+            "M=M+1\n"
+            "($TRIAL)\n"
+            "@SP\n"
+            "A=M\n"
+            "D=M\n"
+            "M=D+M\n" //root += root
+            "D=M\n"
+            "D=D+M\n"
+            "D=D+1\n" //trial = 2 * root + 1
+            "@R14\n"
+            "D=M-D\n"
+            "@$NEXT\n"
+            "D;JLT\n"
+            "@R14\n"
+            "M=D\n" //remainder -= trial
+            "@SP\n"
+            "A=M\n"
+            "M=M+1\n" //root += 1
+            "($NEXT)\n"
+            "@SP\n"
+            "A=M+1\n"
+            "MD=M-1\n"
+            "@$LOOP\n"
+            "D;JGT\n"
+            "@SP\n"
+            "A=M\n"
+            "D=M\n"
+            "A=A-1\n"
+            "M=D\n"
+            "@R15\n"
+            "A=M\n"
+            "0;JMP\n"}},
+    };
+    return routines;
+}
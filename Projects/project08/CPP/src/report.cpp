@@ -0,0 +1,177 @@
+#include "report.h"
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+
+InstructionCounter::InstructionCounter(std::streambuf* target) : target(target), count(0), lineStart(true) {}
+
+void InstructionCounter::scan(char c) {
+    if (c == '\n') {
+        lineStart = true;
+    } else if (lineStart && c != ' ' && c != '\t' && c != '\r') {
+        lineStart = false;
+        if (c != '/' && c != '(') count++; //no instruction starts with / or (
+    }
+}
+
+int InstructionCounter::overflow(int c) {
+    if (c == traits_type::eof()) return traits_type::not_eof(c);
+    scan(static_cast<char>(c));
+    return target->sputc(static_cast<char>(c));
+}
+
+std::streamsize InstructionCounter::xsputn(const char* s, std::streamsize n) {
+    for (std::streamsize i = 0; i < n; i++) scan(s[i]);
+    return target->sputn(s, n);
+}
+
+int InstructionCounter::sync() {
+    return target->pubsync();
+}
+
+std::streampos InstructionCounter::seekoff(std::streamoff off, std::ios_base::seekdir dir, std::ios_base::openmode which) {
+    return target->pubseekoff(off, dir, which); //tellp of the output, see CodeWriter::filePosition
+}
+
+CodeReport::CodeReport() : bootstrapWords(0), sharedWords(0), totalWords(0) {}
+
+std::string CodeReport::opcode(const VMCommand& command) {
+    switch (command.type) {
+        case CommandType::C_ARITHMETIC: return command.arg1;
+        case CommandType::C_PUSH: return "push " + command.arg1;
+        case CommandType::C_POP: return "pop " + command.arg1;
+        case CommandType::C_LABEL: return "label";
+        case CommandType::C_GOTO: return "goto";
+        case CommandType::C_IF: return "if-goto";
+        case CommandType::C_FUNCTION: return "function";
+        case CommandType::C_CALL: return "call";
+        case CommandType::C_RETURN: return "return";
+        default: return "unknown";
+    }
+}
+
+std::string CodeReport::quote(const std::string& str) {
+    std::string quoted = "\"";
+    for (char c : str) {
+        if (c == '"' || c == '\\') quoted += '\\';
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+void CodeReport::add(const std::vector<VMCommand>& commands, size_t pos, size_t used, long words, const std::string& kind) {
+    /**
+     * Records the translation of commands[pos, pos + used).
+     * @param words instructions written for them, deferred work (ex. a spilled
+     * top of stack) counts for the command that wrote it
+     * @param kind name of the translation of several commands (ex. fused) or a
+     * special one, empty for a single command, which is counted under its opcode
+     */
+    const VMCommand& first = commands[pos];
+    if (first.type == CommandType::C_FUNCTION) {
+        endFunction();
+        current = first.arg1;
+        functions[current].entryWords = words;
+    }
+
+    OpcodeCost& cost = opcodes[kind.empty() ? opcode(first) : kind];
+    cost.commands += static_cast<long>(used);
+    cost.words += words;
+
+    FunctionCost& function = functions[current];
+    function.commands += static_cast<long>(used);
+    function.words += words;
+    const VMCommand& last = commands[pos + used - 1];
+    if (kind != "tail call" && last.type == CommandType::C_RETURN) { //ex. push constant 0, return as a void return
+        function.returnWords += words;
+        function.returns++;
+    } else if (kind != "tail call" && first.type == CommandType::C_CALL) { //ex. call, pop temp 0 as a void call
+        callSites[first.arg1].first += words;
+        callSites[first.arg1].second++;
+    }
+
+    for (size_t i = 0; i < used; i++) {
+        body.emplace_back(commands[pos + i], i == 0 ? words : 0);
+    }
+}
+
+void CodeReport::endFunction() {
+    /**
+     * Static cost of the loops of the current function: every goto or if-goto
+     * back to a label of the function runs the code from the label to the jump
+     * once per iteration. Branches inside the loop are counted as if all code
+     * ran, called functions by the code at the call site only.
+     */
+    for (size_t end = 0; end < body.size(); end++) {
+        const VMCommand& jump = body[end].first;
+        if (jump.type != CommandType::C_GOTO && jump.type != CommandType::C_IF) continue;
+        for (size_t start = 0; start < end; start++) {
+            if (body[start].first.type != CommandType::C_LABEL || body[start].first.arg1 != jump.arg1) continue;
+            long cycles = 0;
+            for (size_t pos = start; pos <= end; pos++) cycles += body[pos].second;
+            functions[current].loops.push_back({jump.arg1, static_cast<int>(end - start + 1), cycles});
+            break;
+        }
+    }
+    body.clear();
+}
+
+void CodeReport::write(const std::string& fileName) {
+    /**
+     * Writes the report as JSON: ROM words, then per opcode and per function
+     * counts. Straight line code runs one instruction per cycle, so the word
+     * counts are also the static cycle estimates:
+     * call_cycles = average call site + function entry, return_cycles =
+     * average return, loops = label to jump back, see endFunction.
+     * Shared routines (multiply, divide, tail calls) are in shared_routine_words.
+     */
+    endFunction();
+    std::ofstream output(fileName);
+    if (!output.is_open()) {
+        throw std::runtime_error("Could not open report file: " + fileName);
+    }
+    output << std::fixed << std::setprecision(2);
+
+    output << "{\n"
+           << "  \"rom_words\": " << totalWords << ",\n"
+           << "  \"bootstrap_words\": " << bootstrapWords << ",\n"
+           << "  \"shared_routine_words\": " << sharedWords << ",\n"
+           << "  \"opcodes\": {";
+    const char* separator = "\n";
+    for (const auto& entry : opcodes) {
+        const OpcodeCost& cost = entry.second;
+        output << separator << "    " << quote(entry.first) << ": {\"commands\": " << cost.commands
+               << ", \"words\": " << cost.words
+               << ", \"words_per_command\": " << static_cast<double>(cost.words) / cost.commands << "}";
+        separator = ",\n";
+    }
+    output << "\n  },\n"
+           << "  \"functions\": {";
+    separator = "\n";
+    for (const auto& entry : functions) {
+        const FunctionCost& cost = entry.second;
+        if (cost.commands == 0) continue;
+        output << separator << "    " << quote(entry.first.empty() ? "(no function)" : entry.first) << ": {"
+               << "\"commands\": " << cost.commands << ", \"words\": " << cost.words;
+
+        auto sites = callSites.find(entry.first);
+        if (sites != callSites.end()) {
+            output << ", \"call_sites\": " << sites->second.second
+                   << ", \"call_cycles\": " << static_cast<double>(sites->second.first) / sites->second.second + cost.entryWords;
+        }
+        if (cost.returns > 0) {
+            output << ", \"return_cycles\": " << static_cast<double>(cost.returnWords) / cost.returns;
+        }
+
+        output << ", \"loops\": [";
+        for (size_t i = 0; i < cost.loops.size(); i++) {
+            output << (i ? ", " : "") << "{\"label\": " << quote(cost.loops[i].label)
+                   << ", \"commands\": " << cost.loops[i].commands << ", \"cycles\": " << cost.loops[i].cycles << "}";
+        }
+        output << "]}";
+        separator = ",\n";
+    }
+    output << "\n  }\n"
+           << "}\n";
+}
@@ -0,0 +1,89 @@
+#include "vmbinary.h"
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+static const char* const ARITHMETIC[] = {"add", "sub", "neg", "eq", "gt", "lt", "and", "or", "not"};
+static const char* const SEGMENTS[] = {"constant", "argument", "local", "static", "this", "that", "pointer", "temp"};
+
+std::vector<VMCommand> readBinaryVM(const std::string& filename) {
+    /**
+     * Reads a .vmb file into the same commands Parser::readAll would return for
+     * its text form, without tokenizing anything. VMCommand::source is
+     * "Main.vmb:<record> Main.jack:<line>", records counted from 1.
+     */
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) throw std::runtime_error("Could not open file: " + filename);
+    std::vector<unsigned char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    size_t pos = 0;
+    auto need = [&](size_t bytes) {
+        if (pos + bytes > data.size()) throw std::runtime_error("Truncated .vmb file: " + filename);
+    };
+    auto u16 = [&]() {
+        need(2);
+        int value = data[pos] | (data[pos + 1] << 8);
+        pos += 2;
+        return value;
+    };
+
+    need(4);
+    if (std::string(data.begin(), data.begin() + 4) != "VMB1") {
+        throw std::runtime_error("Not a .vmb file: " + filename);
+    }
+    pos = 4;
+
+    std::vector<std::string> strings(u16());
+    for (auto& string : strings) {
+        int length = u16();
+        need(length);
+        string.assign(data.begin() + pos, data.begin() + pos + length);
+        pos += length;
+    }
+    int source = u16();
+    std::string jackFile = source < static_cast<int>(strings.size()) ? strings[source] : "";
+
+    int low = u16();
+    size_t count = static_cast<size_t>(low) | (static_cast<size_t>(u16()) << 16);
+    std::string name = filename.substr(filename.find_last_of("/\\") + 1);
+    auto stringAt = [&](int index) {
+        if (index >= static_cast<int>(strings.size())) throw std::runtime_error("Bad string index in " + filename);
+        return strings[index];
+    };
+
+    std::vector<VMCommand> commands;
+    commands.reserve(count);
+    for (size_t record = 1; record <= count; record++) {
+        need(8);
+        int opcode = data[pos];
+        int segment = data[pos + 1];
+        pos += 2;
+        int n = u16();
+        int value = u16();
+        int line = u16();
+
+        VMCommand command;
+        switch (static_cast<VMBOpcode>(opcode)) {
+            case VMBOpcode::PUSH:
+            case VMBOpcode::POP:
+                if (segment >= static_cast<int>(std::size(SEGMENTS))) throw std::runtime_error("Bad segment in " + filename);
+                command = {opcode == static_cast<int>(VMBOpcode::PUSH) ? CommandType::C_PUSH : CommandType::C_POP, SEGMENTS[segment], value};
+                break;
+            case VMBOpcode::LABEL: command = {CommandType::C_LABEL, stringAt(value), -1}; break;
+            case VMBOpcode::GOTO: command = {CommandType::C_GOTO, stringAt(value), -1}; break;
+            case VMBOpcode::IF_GOTO: command = {CommandType::C_IF, stringAt(value), -1}; break;
+            case VMBOpcode::FUNCTION: command = {CommandType::C_FUNCTION, stringAt(value), n}; break;
+            case VMBOpcode::CALL: command = {CommandType::C_CALL, stringAt(value), n}; break;
+            case VMBOpcode::RETURN: command = {CommandType::C_RETURN, "", -1}; break;
+            default:
+                if (opcode > static_cast<int>(VMBOpcode::NOT)) {
+                    throw std::runtime_error("Bad opcode " + std::to_string(opcode) + " in " + filename);
+                }
+                command = {CommandType::C_ARITHMETIC, ARITHMETIC[opcode], -1};
+        }
+        command.source = name + ":" + std::to_string(record) + " " +
+                         (jackFile.empty() || line == 0 ? "-" : jackFile + ":" + std::to_string(line));
+        commands.push_back(command);
+    }
+    return commands;
+}
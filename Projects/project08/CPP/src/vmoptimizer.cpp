@@ -0,0 +1,401 @@
+#include "vmoptimizer.h"
+#include "cfg.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cstdint>
+
+Optimizer::Optimizer(bool verbose)
+    : folded(0), simplified(0), propagated(0), removed(0), blocksRemoved(0), blocksMoved(0), verbose(verbose) {}
+
+void Optimizer::verboseOutput(const std::string& message) {
+    if (verbose) {
+        std::cout << message << std::endl;
+    }
+}
+
+bool Optimizer::isArithmetic(const VMCommand& command, const std::string& name) {
+    return command.type == CommandType::C_ARITHMETIC && command.arg1 == name;
+}
+
+bool Optimizer::isBlockEnd(const VMCommand& command) {
+    /**
+     * Commands after which nothing is known about memory: control flow and calls.
+     */
+    return command.type == CommandType::C_LABEL || command.type == CommandType::C_GOTO ||
+           command.type == CommandType::C_IF || command.type == CommandType::C_FUNCTION ||
+           command.type == CommandType::C_CALL || command.type == CommandType::C_RETURN;
+}
+
+bool Optimizer::readConstant(const std::vector<VMCommand>& commands, size_t pos, int& value, size_t& length) {
+    /**
+     * Recognizes a constant value starting at pos. Only non negative numbers can
+     * be pushed, so negative ones show up as push constant c followed by neg or not.
+     * @param value the 16 bit value of the constant
+     * @param length the number of commands it takes
+     */
+    if (pos >= commands.size() || commands[pos].type != CommandType::C_PUSH || commands[pos].arg1 != "constant") {
+        return false;
+    }
+    value = commands[pos].arg2;
+    length = 1;
+    if (pos + 1 < commands.size()) {
+        if (isArithmetic(commands[pos + 1], "neg")) {
+            value = static_cast<int16_t>(-value);
+            length = 2;
+        } else if (isArithmetic(commands[pos + 1], "not")) {
+            value = static_cast<int16_t>(~value);
+            length = 2;
+        }
+    }
+    return true;
+}
+
+void Optimizer::pushConstant(std::vector<VMCommand>& out, int value) {
+    /**
+     * Appends the shortest commands that push the given 16 bit value.
+     */
+    if (value >= 0) {
+        out.push_back({CommandType::C_PUSH, "constant", value});
+    } else {
+        out.push_back({CommandType::C_PUSH, "constant", ~value}); //~value >= 0 for any negative value
+        out.push_back({CommandType::C_ARITHMETIC, "not", -1});
+    }
+}
+
+bool Optimizer::foldConstants(std::vector<VMCommand>& commands) {
+    /**
+     * push constant 3, push constant 4, add -> push constant 7
+     * Arithmetic wraps to 16 bits like on the Hack platform.
+     */
+    std::vector<VMCommand> out;
+    bool changed = false;
+
+    for (size_t i = 0; i < commands.size();) {
+        int x, y;
+        size_t lx, ly;
+        if (readConstant(commands, i, x, lx) && readConstant(commands, i + lx, y, ly) &&
+            i + lx + ly < commands.size() && commands[i + lx + ly].type == CommandType::C_ARITHMETIC) {
+            const std::string& op = commands[i + lx + ly].arg1;
+            int16_t diff = static_cast<int16_t>(x - y);
+            bool known = true;
+            int result = 0;
+
+            if (op == "add") result = static_cast<int16_t>(x + y);
+            else if (op == "sub") result = diff;
+            else if (op == "and") result = static_cast<int16_t>(x & y);
+            else if (op == "or") result = static_cast<int16_t>(x | y);
+            else if (op == "eq") result = diff == 0 ? -1 : 0;
+            else if (op == "gt") result = diff > 0 ? -1 : 0;
+            else if (op == "lt") result = diff < 0 ? -1 : 0;
+            else known = false; //neg/not belong to the second constant
+
+            if (known) {
+                pushConstant(out, result);
+                i += lx + ly + 1;
+                folded++;
+                changed = true;
+                continue;
+            }
+        }
+
+        //a constant followed by a unary command that does not make it shorter
+        if (readConstant(commands, i, x, lx) && lx == 2 && x >= 0) { //ex. push constant 0, neg
+            pushConstant(out, x);
+            i += 2;
+            folded++;
+            changed = true;
+            continue;
+        }
+
+        out.push_back(commands[i]);
+        i++;
+    }
+
+    commands = out;
+    return changed;
+}
+
+bool Optimizer::simplify(std::vector<VMCommand>& commands) {
+    /**
+     * Removes algebraic identities:
+     * push constant 0, add|sub|or -> (nothing)
+     * push constant 0, not, and   -> (nothing)
+     * not, not / neg, neg         -> (nothing)
+     */
+    std::vector<VMCommand> out;
+    bool changed = false;
+
+    for (size_t i = 0; i < commands.size();) {
+        int value;
+        size_t length;
+        if (readConstant(commands, i, value, length) && i + length < commands.size()) {
+            const VMCommand& next = commands[i + length];
+            if ((value == 0 && (isArithmetic(next, "add") || isArithmetic(next, "sub") || isArithmetic(next, "or"))) ||
+                (value == -1 && isArithmetic(next, "and"))) {
+                i += length + 1;
+                simplified++;
+                changed = true;
+                continue;
+            }
+        }
+
+        if (i + 1 < commands.size() &&
+            ((isArithmetic(commands[i], "not") && isArithmetic(commands[i + 1], "not")) ||
+             (isArithmetic(commands[i], "neg") && isArithmetic(commands[i + 1], "neg")))) {
+            i += 2;
+            simplified++;
+            changed = true;
+            continue;
+        }
+
+        out.push_back(commands[i]);
+        i++;
+    }
+
+    commands = out;
+    return changed;
+}
+
+bool Optimizer::propagateCopies(std::vector<VMCommand>& commands) {
+    /**
+     * Within a basic block, after push a / pop b (a, b in temp or local, a may be
+     * a constant) a later push b reads a instead, as long as neither slot was
+     * written in between. A later push a / pop b is then a redundant store and
+     * is dropped. Writes through this/that may alias any slot, so they forget
+     * everything, as do calls and control flow.
+     */
+    std::map<std::string, VMCommand> copies; //"local 2" -> push command holding the same value
+    std::vector<bool> drop(commands.size(), false);
+    bool changed = false;
+
+    auto key = [](const VMCommand& command) { return command.arg1 + " " + std::to_string(command.arg2); };
+    auto tracked = [](const std::string& segment) { return segment == "local" || segment == "temp"; };
+    auto forget = [&](const std::string& slot) {
+        copies.erase(slot);
+        for (auto it = copies.begin(); it != copies.end();) {
+            if (key(it->second) == slot) it = copies.erase(it);
+            else ++it;
+        }
+    };
+
+    for (size_t i = 0; i < commands.size(); i++) {
+        VMCommand& command = commands[i];
+
+        if (isBlockEnd(command)) {
+            copies.clear();
+        } else if (command.type == CommandType::C_PUSH && tracked(command.arg1)) {
+            auto it = copies.find(key(command));
+            if (it != copies.end()) {
+                command = it->second;
+                propagated++;
+                changed = true;
+            }
+        } else if (command.type == CommandType::C_POP) {
+            if (command.arg1 == "this" || command.arg1 == "that") {
+                copies.clear();
+                continue;
+            }
+            std::string slot = key(command);
+            const VMCommand* previous = i > 0 && !drop[i - 1] && commands[i - 1].type == CommandType::C_PUSH ? &commands[i - 1] : nullptr;
+
+            auto known = copies.find(slot);
+            if (previous && known != copies.end() && key(known->second) == key(*previous)) {
+                drop[i - 1] = drop[i] = true; //slot already holds that value
+                removed++;
+                changed = true;
+                continue;
+            }
+
+            forget(slot);
+            if (previous && tracked(command.arg1) && (previous->arg1 == "constant" || tracked(previous->arg1)) &&
+                key(*previous) != slot) {
+                copies[slot] = *previous;
+            }
+        }
+    }
+
+    if (changed) {
+        std::vector<VMCommand> out;
+        for (size_t i = 0; i < commands.size(); i++) {
+            if (!drop[i]) out.push_back(commands[i]);
+        }
+        commands = out;
+    }
+    return changed;
+}
+
+bool Optimizer::removeDeadPairs(std::vector<VMCommand>& commands) {
+    /**
+     * push s i, pop s i                  -> (nothing)
+     * push x, pop temp i ... pop temp i  -> the first pair is dropped when temp i
+     * is overwritten in the same basic block before anything could read it.
+     */
+    std::vector<bool> drop(commands.size(), false);
+    bool changed = false;
+
+    for (size_t i = 0; i + 1 < commands.size(); i++) {
+        const VMCommand& push = commands[i];
+        const VMCommand& pop = commands[i + 1];
+        if (push.type != CommandType::C_PUSH || pop.type != CommandType::C_POP) continue;
+
+        bool dead = push.arg1 == pop.arg1 && push.arg2 == pop.arg2;
+
+        if (!dead && pop.arg1 == "temp") {
+            for (size_t j = i + 2; j < commands.size(); j++) {
+                const VMCommand& next = commands[j];
+                if (isBlockEnd(next)) break;
+                if (next.type == CommandType::C_PUSH &&
+                    ((next.arg1 == "temp" && next.arg2 == pop.arg2) || next.arg1 == "this" || next.arg1 == "that")) {
+                    break; //read, possibly through an aliasing pointer
+                }
+                if (next.type == CommandType::C_POP && next.arg1 == "temp" && next.arg2 == pop.arg2) {
+                    dead = true;
+                    break;
+                }
+            }
+        }
+
+        if (dead) {
+            drop[i] = drop[i + 1] = true;
+            removed++;
+            changed = true;
+            i++;
+        }
+    }
+
+    if (changed) {
+        std::vector<VMCommand> out;
+        for (size_t i = 0; i < commands.size(); i++) {
+            if (!drop[i]) out.push_back(commands[i]);
+        }
+        commands = out;
+    }
+    return changed;
+}
+
+bool Optimizer::simplifyControlFlow(std::vector<VMCommand>& commands) {
+    /**
+     * Builds a control flow graph for every function and lets it thread jumps,
+     * invert branches and drop unreachable blocks.
+     */
+    std::vector<VMCommand> out;
+    bool changed = false;
+
+    for (const auto& function : ControlFlowGraph::splitFunctions(commands)) {
+        ControlFlowGraph cfg(function);
+        size_t before = cfg.blockCount();
+        if (cfg.simplify()) changed = true;
+        size_t after = cfg.blockCount();
+        blocksRemoved += static_cast<int>(before - after);
+
+        std::string name = function[0].type == CommandType::C_FUNCTION ? function[0].arg1 : "(top level)";
+        verboseOutput("CFG: " + name + ": " + (after != before ? std::to_string(before) + " -> " : "") +
+                      std::to_string(after) + (after == 1 ? " basic block" : " basic blocks"));
+
+        std::vector<VMCommand> simplified = cfg.commands();
+        out.insert(out.end(), simplified.begin(), simplified.end());
+    }
+
+    commands = out;
+    return changed;
+}
+
+std::vector<VMCommand> Optimizer::optimize(std::vector<VMCommand> commands) {
+    /**
+     * Runs the peephole passes until none of them finds anything left to do,
+     * then simplifies the control flow and gives the peephole passes another go
+     * at the code that was brought together.
+     * @param commands the commands of one .vm file
+     * @return the optimized commands
+     */
+    auto peephole = [&]() {
+        bool changed = true;
+        while (changed) {
+            changed = foldConstants(commands);
+            changed |= simplify(commands);
+            changed |= propagateCopies(commands);
+            changed |= removeDeadPairs(commands);
+        }
+    };
+
+    peephole();
+    if (simplifyControlFlow(commands)) {
+        peephole();
+    }
+    return commands;
+}
+
+std::vector<VMCommand> Optimizer::layout(const std::vector<VMCommand>& commands, const std::map<std::string, long>& profile) {
+    /**
+     * Reorders the basic blocks of every function so likely successors fall
+     * through, see ControlFlowGraph::layout.
+     * @param commands the commands of one .vm file
+     * @param profile label counts from readProfile, may be empty
+     * @return the reordered commands
+     */
+    std::vector<VMCommand> out;
+    for (const auto& function : ControlFlowGraph::splitFunctions(commands)) {
+        ControlFlowGraph cfg(function);
+        int moved = cfg.layout(profile);
+        blocksMoved += moved;
+        if (moved > 0) {
+            std::string name = function[0].type == CommandType::C_FUNCTION ? function[0].arg1 : "(top level)";
+            verboseOutput("Layout: " + name + ": " + std::to_string(moved) + " blocks moved");
+        }
+
+        std::vector<VMCommand> laidOut = cfg.commands();
+        out.insert(out.end(), laidOut.begin(), laidOut.end());
+    }
+    return out;
+}
+
+std::string Optimizer::summary() const {
+    return std::to_string(folded) + " folded, " + std::to_string(simplified) + " simplified, " +
+           std::to_string(propagated) + " propagated, " + std::to_string(removed) + " dead pairs removed, " +
+           std::to_string(blocksRemoved) + " basic blocks removed, " + std::to_string(blocksMoved) + " moved";
+}
+
+std::map<std::string, long> Optimizer::readProfile(const std::string& fileName) {
+    /**
+     * Reads a block profile: one "Function$label count" pair per line, the
+     * label names as they appear in the generated assembly. Lines starting
+     * with // are comments.
+     * @return label -> times it was reached
+     */
+    std::ifstream input(fileName);
+    if (!input.is_open()) {
+        throw std::runtime_error("Could not open profile: " + fileName);
+    }
+
+    std::map<std::string, long> counts;
+    std::string line;
+    int lineNum = 0;
+    while (std::getline(input, line)) {
+        lineNum++;
+        if (line.empty() || line.rfind("//", 0) == 0) continue;
+
+        std::istringstream fields(line);
+        std::string label;
+        long count;
+        if (!(fields >> label >> count)) {
+            throw std::runtime_error("Invalid profile line " + std::to_string(lineNum) + " in " + fileName);
+        }
+        counts[label] += count;
+    }
+    return counts;
+}
+
+void Optimizer::writeVM(const std::string& fileName, const std::vector<VMCommand>& commands) {
+    /**
+     * Writes commands back out as a .vm file.
+     */
+    std::ofstream output(fileName);
+    if (!output.is_open()) {
+        throw std::runtime_error("Could not open output file: " + fileName);
+    }
+    for (const auto& command : commands) {
+        output << formatCommand(command) << "\n";
+    }
+}
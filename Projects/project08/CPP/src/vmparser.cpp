@@ -4,15 +4,58 @@
 #include <algorithm>
 #include <cctype>
 
-Parser::Parser(const std::string& filename): currentLine(0) {
+std::string formatCommand(const VMCommand& command) {
+    switch (command.type) {
+        case CommandType::C_ARITHMETIC: return command.arg1;
+        case CommandType::C_PUSH: return "push " + command.arg1 + " " + std::to_string(command.arg2);
+        case CommandType::C_POP: return "pop " + command.arg1 + " " + std::to_string(command.arg2);
+        case CommandType::C_LABEL: return "label " + command.arg1;
+        case CommandType::C_GOTO: return "goto " + command.arg1;
+        case CommandType::C_IF: return "if-goto " + command.arg1;
+        case CommandType::C_FUNCTION: return "function " + command.arg1 + " " + std::to_string(command.arg2);
+        case CommandType::C_CALL: return "call " + command.arg1 + " " + std::to_string(command.arg2);
+        case CommandType::C_RETURN: return "return";
+        default: throw std::runtime_error("Cannot format unknown command");
+    }
+}
+
+Parser::Parser(const std::string& filename): currentLine(0), stream(nullptr), jackLine("-"), lineNumber(0) {
     std::ifstream file(filename);
     if (!file.is_open()) throw std::runtime_error("Could not open file: " + filename);
 
+    name = filename.substr(filename.find_last_of("/\\") + 1);
+    while (file) {
+        readLine(file);
+    }
+}
+
+Parser::Parser(std::istream& input, const std::string& name): currentLine(0), stream(&input), name(name), jackLine("-"), lineNumber(0) {
+    /**
+     * Parses commands from a stream as they are asked for, so a translation
+     * can start before the whole input has arrived, ex. from a pipe.
+     */
+}
+
+bool Parser::readLine(std::istream& input) {
+    /**
+     * Reads one line, keeping it if it holds a command.
+     * @return true if a command was added
+     */
     std::string line;
-    while (std::getline(file, line)) {
-        line = trim(removeComments(line));
-        if (!line.empty()) lines.push_back(line);
+    if (!std::getline(input, line)) return false;
+    lineNumber++;
+
+    std::string marker = trim(line);
+    if (marker.compare(0, 3, "//@") == 0) {
+        jackLine = trim(marker.substr(3));
+        return false;
     }
+    line = trim(removeComments(line));
+    if (line.empty()) return false;
+
+    lines.push_back(line);
+    sources.push_back(name + ":" + std::to_string(lineNumber) + " " + jackLine);
+    return true;
 }
 
 std::string Parser::trim(const std::string& str) {
@@ -32,6 +75,9 @@ std::string Parser::removeComments(const std::string& line) {
 }
 
 bool Parser::hasMoreCommands() {
+    while (currentLine >= lines.size() && stream != nullptr) {
+        if (!readLine(*stream) && !*stream) stream = nullptr; //end of input
+    }
     return currentLine < lines.size();
 }
 
@@ -114,6 +160,34 @@ int Parser::arg2() {
     return -1;
 }
 
+VMCommand Parser::command() {
+    /**
+     * Returns the current command with its arguments already parsed.
+     */
+    CommandType type = commandType();
+    std::string source = currentLine > 0 ? sources[currentLine - 1] : "";
+    if (type == CommandType::C_ARITHMETIC || type == CommandType::C_LABEL ||
+        type == CommandType::C_GOTO || type == CommandType::C_IF) {
+        return {type, arg1(), -1, source};
+    }
+    return {type, arg1(), arg2(), source};
+}
+
+std::vector<VMCommand> Parser::readAll() {
+    /**
+     * Parses every command of the file from the beginning, for stages that
+     * need to look ahead in the command stream.
+     */
+    std::vector<VMCommand> commands;
+    reset();
+    while (hasMoreCommands()) {
+        advance();
+        commands.push_back(command());
+    }
+    reset();
+    return commands;
+}
+
 void Parser::reset() {
     currentLine = 0;
     currentCommand.clear();
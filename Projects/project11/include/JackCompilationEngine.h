@@ -23,7 +23,7 @@ private:
     Segment kindToSegment(SegmentKind kind);
     
 public:
-    CompilationEngine(JackTokenizer& tok, const std::string& outputFile);
+    CompilationEngine(JackTokenizer& tok, const std::string& outputFile, const std::string& sourceFile = "", bool binary = false);
     
     void compileClass();
     void compileClassVarDec();
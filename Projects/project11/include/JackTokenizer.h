@@ -26,6 +26,8 @@ class JackTokenizer {
         std::string currentLine;
         size_t currentPos;
         bool hasMoreTokens_; //flag to indicate if there are more tokens
+        int lineNumber; //lines read so far
+        int tokenLine; //line the current token is on
 
         static const std::unordered_set<std::string> keywords;
         static const std::unordered_set<char> symbols;
@@ -50,6 +52,7 @@ class JackTokenizer {
         int intVal();
         std::string stringVal();
         std::string getCurrentToken();
+        int getLineNumber();
         void writeTokensToXml(const std::string& outputFile);
 };
 
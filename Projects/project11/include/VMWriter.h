@@ -3,6 +3,8 @@
 
 #include <string>
 #include <fstream>
+#include <vector>
+#include <unordered_map>
 
 enum class Segment {
     CONST,
@@ -27,17 +29,43 @@ enum class Command {
     NOT
 };
 
+enum class Opcode { //.vmb record opcodes, 0-8 are the Command values, see project08 vmbinary.h
+    PUSH = 9,
+    POP,
+    LABEL,
+    GOTO,
+    IF_GOTO,
+    FUNCTION,
+    CALL,
+    RETURN
+};
+
 class VMWriter {
     private:
-        std::ofstream output;
+        std::ofstream file; //unused when writing to stdout
+        std::ostream output;
+        std::string sourceFile; //Jack file named in the line markers, empty if they are off
+        int sourceLine; //line of the statement being compiled
+        int markedLine; //line of the last marker written
+        bool binary; //write .vmb records instead of text, see writeBinary
+        std::vector<unsigned char> records; //8 byte .vmb records, written out on close
+        std::vector<std::string> strings; //.vmb string table
+        std::unordered_map<std::string, int> stringIndex;
 
         std::string segmentToString(Segment segment); //helper to convert enums to strings
         std::string commandToString(Command command); //helper to convert enums to strings
+        void writeMarker(); //line marker before the first command of a new line
+        int intern(const std::string& str); //index of str in the .vmb string table
+        void writeRecord(int opcode, int segment, int count, int value);
+        void writeBinary();
 
     public:
-        VMWriter(const std::string& outputFile);
+        VMWriter(const std::string& outputFile, bool binary = false); //"-" writes to stdout
         ~VMWriter();
 
+        void setSourceFile(const std::string& file); //turns on //@ File.jack:line markers
+        void setLine(int line);
+
         void writePush(Segment segment, int index);
         void writePop(Segment segment, int index);
         void writeArithmetic(Command command);
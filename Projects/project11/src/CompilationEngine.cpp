@@ -1,8 +1,12 @@
 #include "JackCompilationEngine.h"
 #include <stdexcept>
 
-CompilationEngine::CompilationEngine(JackTokenizer& tok, const std::string& outputFile)
-    : tokenizer(tok), vmWriter(outputFile), labelCounter(0) {}
+CompilationEngine::CompilationEngine(JackTokenizer& tok, const std::string& outputFile, const std::string& sourceFile, bool binary)
+    : tokenizer(tok), vmWriter(outputFile, binary), labelCounter(0) {
+    if (!sourceFile.empty()) {
+        vmWriter.setSourceFile(sourceFile); //mark the Jack line of every statement in the .vm
+    }
+}
 
 void CompilationEngine::eat(const std::string& expected) {
     if (tokenizer.getCurrentToken() != expected) {
@@ -83,6 +87,7 @@ void CompilationEngine::compileClassVarDec() {
 
 void CompilationEngine::compileSubroutine() {
     symbolTable.startSubroutine();
+    int line = tokenizer.getLineNumber();
     
     std::string subroutineType = tokenizer.getCurrentToken();
     tokenizer.advance();
@@ -109,6 +114,7 @@ void CompilationEngine::compileSubroutine() {
     }
     
     int nLocals = symbolTable.varCount(SegmentKind::VAR);
+    vmWriter.setLine(line);
     vmWriter.writeFunction(currentFunction, nLocals);
     
     if (subroutineType == "constructor") {
@@ -169,6 +175,7 @@ void CompilationEngine::compileVarDec() {
 
 void CompilationEngine::compileStatements() {
     while (true) {
+        vmWriter.setLine(tokenizer.getLineNumber());
         if (tokenizer.getCurrentToken() == "let") {
             compileLet();
         } else if (tokenizer.getCurrentToken() == "if") {
@@ -266,6 +273,7 @@ void CompilationEngine::compileLet() {
 void CompilationEngine::compileWhile() {
     std::string labelWhile = generateLabel("WHILE_EXP");
     std::string labelEnd = generateLabel("WHILE_END");
+    int line = tokenizer.getLineNumber();
     
     vmWriter.writeLabel(labelWhile);
     
@@ -281,6 +289,7 @@ void CompilationEngine::compileWhile() {
     compileStatements();
     eatSymbol('}');
     
+    vmWriter.setLine(line); //the jump back belongs to the while
     vmWriter.writeGoto(labelWhile);
     vmWriter.writeLabel(labelEnd);
 }
@@ -22,19 +22,38 @@ std::vector<std::string> getJackFiles(const std::string& path) {
     return files;
 }
 
-std::string getOutputFilename(const std::string& inputFile) {
+std::string getOutputFilename(const std::string& inputFile, bool binary) {
     fs::path p(inputFile);
-    p.replace_extension(".vm");
+    p.replace_extension(binary ? ".vmb" : ".vm");
     return p.string();
 }
 
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        std::cerr << "Usage: JackCompiler <input.jack | directory>\n";
+    bool sourceMap = false;
+    bool binary = false;
+    bool toStdout = false;
+    std::string input;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--source-map") {
+            sourceMap = true; //write //@ File.jack:line markers into the .vm files
+        } else if (arg == "--binary") {
+            binary = true; //write .vmb files, see the VM translator's vmbinary.h
+        } else if (arg == "--stdout") {
+            toStdout = true; //write every class to stdout, ex. to pipe into the VM translator
+        } else if (input.empty() && arg[0] != '-') {
+            input = arg;
+        } else {
+            input.clear();
+            break;
+        }
+    }
+
+    if (input.empty() || (binary && toStdout)) {
+        std::cerr << "Usage: JackCompiler [--source-map] [--binary | --stdout] <input.jack | directory>\n";
         return 1;
     }
-    
-    std::string input = argv[1];
+    std::ostream& log = toStdout ? std::cerr : std::cout; //stdout carries the VM code
     std::vector<std::string> jackFiles = getJackFiles(input);
     
     if (jackFiles.empty()) {
@@ -44,16 +63,19 @@ int main(int argc, char* argv[]) {
     
     for (const auto& file : jackFiles) {
         try {
-            std::cout << "Compiling " << file << "...\n";
+            log << "Compiling " << file << "...\n";
             
             JackTokenizer tokenizer(file);
-            std::string outputFile = getOutputFilename(file);
-            CompilationEngine engine(tokenizer, outputFile);
+            std::string outputFile = toStdout ? "-" : getOutputFilename(file, binary);
+            std::string sourceFile = sourceMap ? fs::path(file).filename().string() : "";
+            CompilationEngine engine(tokenizer, outputFile, sourceFile, binary);
             
             tokenizer.advance(); //get first token
             engine.compileClass();
             
-            std::cout << "Created " << outputFile << "\n";
+            if (!toStdout) {
+                std::cout << "Created " << outputFile << "\n";
+            }
         } catch (const std::exception& e) {
             std::cerr << "Error processing " << file << ": " 
                       << e.what() << "\n";
@@ -61,6 +83,6 @@ int main(int argc, char* argv[]) {
         }
     }
     
-    std::cout << "Compilation completed successfully!\n";
+    log << "Compilation completed successfully!\n";
     return 0;
 }
\ No newline at end of file
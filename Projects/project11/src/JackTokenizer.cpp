@@ -13,7 +13,7 @@ const std::unordered_set<char> JackTokenizer::symbols = {
 };
 
 JackTokenizer::JackTokenizer(const std::string& filename)
-    : currentPos(0), hasMoreTokens_(true) {  //start with true
+    : currentPos(0), hasMoreTokens_(true), lineNumber(1), tokenLine(1) {  //start with true
     input.open(filename);
     if (!input.is_open()) {
         throw std::runtime_error("Failed to open file: " + filename);
@@ -51,6 +51,7 @@ void JackTokenizer::skipWhitespaceAndComments() {
                         if (!std::getline(input, currentLine)) {
                             return;
                         }
+                        lineNumber++;
                         currentPos = 0;
                     }
                     if (currentPos < currentLine.length() - 1 && currentLine[currentPos] == '*' && currentLine[currentPos + 1] == '/') {
@@ -68,6 +69,7 @@ void JackTokenizer::skipWhitespaceAndComments() {
             if (!std::getline(input, currentLine)) {
                 return;
             }
+            lineNumber++;
             currentPos = 0;
             continue;
         }
@@ -81,6 +83,7 @@ bool JackTokenizer::hasMoreTokens() {
 
 void JackTokenizer::readNextToken() {
     skipWhitespaceAndComments();
+    tokenLine = lineNumber;
 
     if (currentPos >= currentLine.length()) {
         hasMoreTokens_ = false;
@@ -189,6 +192,10 @@ std::string JackTokenizer::stringVal() {
     return currentToken;
 }
 
+int JackTokenizer::getLineNumber() { //line of the current token, counting from 1
+    return tokenLine;
+}
+
 std::string JackTokenizer::getCurrentToken() {
     return currentToken;
 }
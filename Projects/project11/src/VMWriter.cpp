@@ -1,19 +1,93 @@
 #include "VMWriter.h"
 #include <stdexcept>
+#include <iostream>
 
-VMWriter::VMWriter(const std::string& outputFile) {
-    output.open(outputFile);
-    if (!output.is_open()) {
+VMWriter::VMWriter(const std::string& outputFile, bool binary) : output(nullptr), sourceLine(0), markedLine(0), binary(binary) {
+    if (outputFile == "-") {
+        output.rdbuf(std::cout.rdbuf());
+        return;
+    }
+    file.open(outputFile, binary ? std::ios::out | std::ios::binary : std::ios::out);
+    if (!file.is_open()) {
         throw std::runtime_error("Could not open file: " + outputFile);
     }
+    output.rdbuf(file.rdbuf());
 }
 
 VMWriter::~VMWriter() {
-    if (output.is_open()) {
-        output.close();
+    if (binary) {
+        writeBinary();
+    }
+    output.flush(); //a class on stdout goes down the pipe as soon as it is compiled
+    if (file.is_open()) {
+        file.close();
+    }
+}
+
+void VMWriter::setSourceFile(const std::string& file) {
+    sourceFile = file;
+}
+
+void VMWriter::setLine(int line) {
+    sourceLine = line;
+}
+
+void VMWriter::writeMarker() {
+    /**
+     * Writes "//@ File.jack:line" when the commands that follow come from a
+     * different line than the ones before, see setSourceFile. It is a comment,
+     * so tools that do not read it still accept the file.
+     */
+    if (sourceFile.empty() || sourceLine == markedLine) return;
+    output << "//@ " << sourceFile << ":" << sourceLine << "\n";
+    markedLine = sourceLine;
+}
+
+int VMWriter::intern(const std::string& str) {
+    auto it = stringIndex.find(str);
+    if (it != stringIndex.end()) {
+        return it->second;
+    }
+    strings.push_back(str);
+    return stringIndex[str] = static_cast<int>(strings.size()) - 1;
+}
+
+void VMWriter::writeRecord(int opcode, int segment, int count, int value) {
+    /**
+     * Appends one .vmb record: u8 opcode, u8 segment, u16 count, u16 value,
+     * u16 line, little endian. The format is described in the VM translator's
+     * vmbinary.h, opcodes 0-8 are the Command values and segments the Segment values.
+     */
+    int line = sourceFile.empty() ? 0 : sourceLine;
+    for (int byte : {opcode, segment, count & 0xFF, count >> 8, value & 0xFF, (value >> 8) & 0xFF, line & 0xFF, (line >> 8) & 0xFF}) {
+        records.push_back(static_cast<unsigned char>(byte));
     }
 }
 
+void VMWriter::writeBinary() {
+    /**
+     * Writes the .vmb file: magic, string table, source file, then the records.
+     */
+    auto u16 = [this](int value) {
+        output.put(static_cast<char>(value & 0xFF));
+        output.put(static_cast<char>((value >> 8) & 0xFF));
+    };
+
+    int source = sourceFile.empty() ? 0xFFFF : intern(sourceFile);
+    output << "VMB1";
+    u16(static_cast<int>(strings.size()));
+    for (const auto& str : strings) {
+        u16(static_cast<int>(str.size()));
+        output << str;
+    }
+    u16(source);
+
+    size_t count = records.size() / 8;
+    u16(static_cast<int>(count & 0xFFFF));
+    u16(static_cast<int>(count >> 16));
+    output.write(reinterpret_cast<const char*>(records.data()), records.size());
+}
+
 std::string VMWriter::segmentToString(Segment segment) {
     switch (segment) {
         case Segment::CONST: return "constant";
@@ -46,37 +120,82 @@ std::string VMWriter::commandToString(Command command) {
 }
 
 void VMWriter::writePush(Segment segment, int index) {
+    if (binary) {
+        writeRecord(static_cast<int>(Opcode::PUSH), static_cast<int>(segment), 0, index);
+        return;
+    }
+    writeMarker();
     output << "push " << segmentToString(segment) << " " << index << "\n";
 }
 
 void VMWriter::writePop(Segment segment, int index) {
+    if (binary) {
+        writeRecord(static_cast<int>(Opcode::POP), static_cast<int>(segment), 0, index);
+        return;
+    }
+    writeMarker();
     output << "pop " << segmentToString(segment) << " " << index << "\n";
 }
 
 void VMWriter::writeArithmetic(Command command) {
+    if (binary) {
+        writeRecord(static_cast<int>(command), 0, 0, 0);
+        return;
+    }
+    writeMarker();
     output << commandToString(command) << "\n";
 }
 
 void VMWriter::writeLabel(const std::string& label) {
+    if (binary) {
+        writeRecord(static_cast<int>(Opcode::LABEL), 0, 0, intern(label));
+        return;
+    }
+    writeMarker();
     output << "label " << label << "\n";
 }
 
 void VMWriter::writeGoto(const std::string& label) {
+    if (binary) {
+        writeRecord(static_cast<int>(Opcode::GOTO), 0, 0, intern(label));
+        return;
+    }
+    writeMarker();
     output << "goto " << label << "\n";
 }
 
 void VMWriter::writeIf(const std::string& label) {
+    if (binary) {
+        writeRecord(static_cast<int>(Opcode::IF_GOTO), 0, 0, intern(label));
+        return;
+    }
+    writeMarker();
     output << "if-goto " << label << "\n";
 }
 
 void VMWriter::writeCall(const std::string& name, int nArgs) {
+    if (binary) {
+        writeRecord(static_cast<int>(Opcode::CALL), 0, nArgs, intern(name));
+        return;
+    }
+    writeMarker();
     output << "call " << name << " " << nArgs << "\n";
 }
 
 void VMWriter::writeFunction(const std::string& name, int nLocals) {
+    if (binary) {
+        writeRecord(static_cast<int>(Opcode::FUNCTION), 0, nLocals, intern(name));
+        return;
+    }
+    writeMarker();
     output << "function " << name << " " << nLocals << "\n";
 }
 
 void VMWriter::writeReturn() {
+    if (binary) {
+        writeRecord(static_cast<int>(Opcode::RETURN), 0, 0, 0);
+        return;
+    }
+    writeMarker();
     output << "return\n";
 }
\ No newline at end of file